@@ -0,0 +1,117 @@
+#!/bin/bash
+# Scaling benchmark for training and inference.
+#
+# Generates synthetic piecewise affine data-sets for a grid of row counts, dimensions,
+# region counts and noise levels, runs ./train and ./infer on each and writes one CSV
+# line per configuration to bench_output.txt. If a baseline file exists, the timings
+# are compared against it.
+#
+# Usage: bench/run_bench.sh [--update-baseline]
+# The grid and limits can be set through the environment, for example:
+#   BENCH_ROWS="1000 10000" BENCH_DIMS="2 4" make bench
+
+ROWS=${BENCH_ROWS:-"1000 10000 100000 1000000 10000000"}
+DIMS=${BENCH_DIMS:-"2 4 8 16 32"}
+REGIONS=${BENCH_REGIONS:-"2 4 8"}
+NOISE=${BENCH_NOISE:-"0 0.05"}
+GUARD=${BENCH_GUARD:-oblique}
+THRESHOLD=${BENCH_THRESHOLD:-0.5}
+TIMEOUT=${BENCH_TIMEOUT:-3600}
+TOLERANCE=${BENCH_TOLERANCE:-0.1}
+SEED=${BENCH_SEED:-1}
+BASELINE=${BENCH_BASELINE:-bench/baseline.csv}
+OUTPUT=${BENCH_OUTPUT:-bench_output.txt}
+WORK_DIR=${BENCH_WORK_DIR:-bench/data}
+
+mkdir -p "$WORK_DIR"
+
+HEADER="rows,dims,regions,noise,train_s,train_rows_per_s,train_peak_rss_kb,infer_s,infer_rows_per_s,infer_peak_rss_kb,num_regions,test_rmse,test_precision"
+
+# Generates a data-set with ./gen_data for the given rows, dims, regions, noise and first
+# row (the test rows follow the train rows of the same model).
+gen_data() {
+  ./gen_data -n "$1" -d "$2" -r "$3" -g "$GUARD" --noise "$4" --seed "$SEED" --first_row "$5" -o "$6"
+}
+
+# Runs a command, printing "<wall seconds> <peak rss kb>" to fd 3, with the command
+# output on stdout.
+measure() {
+  local start end rss_file status
+  rss_file=$(mktemp)
+  start=$(date +%s.%N)
+  if [ -x /usr/bin/time ]; then
+    timeout "$TIMEOUT" /usr/bin/time -o "$rss_file" -f "%M" "$@"
+  else
+    echo "NA" > "$rss_file"
+    timeout "$TIMEOUT" "$@"
+  fi
+  status=$?
+  end=$(date +%s.%N)
+  if [ $status -eq 124 ]; then
+    echo "timeout NA" >&3
+  else
+    echo "$(awk -v s="$start" -v e="$end" 'BEGIN { printf "%.3f", e - s }') $(tail -1 "$rss_file")" >&3
+  fi
+  rm -f "$rss_file"
+}
+
+rate() {
+  if [ "$2" = "timeout" ]; then echo "NA"; else awk -v n="$1" -v t="$2" 'BEGIN { printf "%.1f", (t > 0 ? n/t : 0) }'; fi
+}
+
+echo "$HEADER" > "$OUTPUT"
+for rows in $ROWS; do
+  for dims in $DIMS; do
+    for regions in $REGIONS; do
+      for noise in $NOISE; do
+        train_data="$WORK_DIR/train_${GUARD}_${rows}_${dims}_${regions}_${noise}.csv"
+        test_data="$WORK_DIR/test_${GUARD}_${rows}_${dims}_${regions}_${noise}.csv"
+        model="$WORK_DIR/model_${GUARD}_${rows}_${dims}_${regions}_${noise}.json"
+        test_rows=$(( rows < 100000 ? rows : 100000 ))
+        [ -f "$train_data" ] || gen_data "$rows" "$dims" "$regions" "$noise" 0 "$train_data"
+        [ -f "$test_data" ] || gen_data "$test_rows" "$dims" "$regions" "$noise" "$rows" "$test_data"
+
+        read train_s train_rss < <(measure ./train -t "$THRESHOLD" -o "$model" "$train_data" 3>&1 >/dev/null 2>&1)
+        infer_s=timeout; infer_rss=NA; num_regions=NA; rmse=NA; precision=NA
+        if [ "$train_s" != "timeout" ] && [ -f "$model" ]; then
+          infer_log=$(mktemp)
+          read infer_s infer_rss < <(measure ./infer -i "$model" -t "$THRESHOLD" "$test_data" 3>&1 >"$infer_log" 2>&1)
+          rmse=$(grep "RMSE" "$infer_log" | awk '{print $2}')
+          precision=$(grep "Precision" "$infer_log" | awk '{print $2}')
+          num_regions=$(./model_stats "$model" | grep -o "Number of Regions: [0-9]*" | awk '{print $4}')
+          rm -f "$infer_log"
+        fi
+        line="$rows,$dims,$regions,$noise,$train_s,$(rate "$rows" "$train_s"),$train_rss,$infer_s,$(rate "$test_rows" "$infer_s"),$infer_rss,$num_regions,$rmse,$precision"
+        echo "$line" >> "$OUTPUT"
+        echo "$line"
+      done
+    done
+  done
+done
+
+if [ "$1" = "--update-baseline" ]; then
+  cp "$OUTPUT" "$BASELINE"
+  echo "Baseline updated: $BASELINE"
+  exit 0
+fi
+
+if [ ! -f "$BASELINE" ]; then
+  echo "No baseline found at $BASELINE (run with --update-baseline to create it)."
+  exit 0
+fi
+
+# Compare train and inference times with the baseline, for matching configurations.
+awk -F, -v tolerance="$TOLERANCE" '
+  NR == FNR { if (FNR > 1) { train[$1","$2","$3","$4] = $5; infer[$1","$2","$3","$4] = $8; } next; }
+  FNR == 1 { printf "%-28s %12s %12s %12s %12s\n", "config", "train_s", "vs_base", "infer_s", "vs_base"; next; }
+  {
+    key = $1","$2","$3","$4;
+    if (!(key in train)) next;
+    t_ratio = (train[key] > 0 && $5 != "timeout") ? $5/train[key] : 0;
+    i_ratio = (infer[key] > 0 && $8 != "timeout") ? $8/infer[key] : 0;
+    flag = (t_ratio > 1 + tolerance || i_ratio > 1 + tolerance || $5 == "timeout") ? "  REGRESSION" : "";
+    if (flag != "") regressions++;
+    printf "%-28s %12s %12.2f %12s %12.2f%s\n", key, $5, t_ratio, $8, i_ratio, flag;
+  }
+  END { if (regressions > 0) { print regressions " configuration(s) slower than baseline."; exit 1; } }
+' "$BASELINE" "$OUTPUT"
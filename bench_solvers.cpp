@@ -0,0 +1,155 @@
+#include "AlgLibUtils.hpp"
+#include "Profiler.hpp"
+#include "SolverCapture.hpp"
+#include "Solvers.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Replays the solver calls captured by `train --capture` and times each primitive on its
+// own, so that solvers and heuristics can be compared on the calls of real training runs.
+
+const char* kind_names[] = {"predicate", "regression", "split", "ce_function"};
+
+struct kindStats
+{
+    std::vector<long long> times_us;
+    long long captured_us = 0;
+    int changed = 0;
+};
+
+// Whether the replayed result differs from the captured one: a different feasibility (or
+// split sizes), or coefficients that differ by more than a tolerance.
+bool resultChanged(const std::vector<float>& captured, const std::vector<float>& replayed)
+{
+    if (captured.size() != replayed.size()) return true;
+    for (int i = 0; i < captured.size(); i++)
+        if (std::fabs(captured[i] - replayed[i]) > 0.001*std::max(1.0f, std::fabs(captured[i])))
+            return true;
+    return false;
+}
+
+std::vector<float> replay(const pointStore& s, const capturedCall& call)
+{
+    pointGroup first(s, call.first.begin(), call.first.end());
+    pointGroup rest(s, call.rest.begin(), call.rest.end());
+    int ce = call.rest.empty() ? -1 : call.rest[0];
+    switch (call.kind)
+    {
+    case solverCapture::PREDICATE:
+        return genPredicateUsingAlgLib(s, first, rest, s.num_vars).coeff;
+    case solverCapture::REGRESSION:
+    {
+        // The outputs are captured for the regression points only.
+        std::vector<float> outputs(s.size(), 0.0);
+        for (int i = 0; i < call.first.size(); i++) outputs[call.first[i]] = call.outputs[i];
+        return trainModelUsingAlgLib(s, outputs, call.first, s.num_vars).coeff;
+    }
+    case solverCapture::SPLIT:
+    {
+        std::vector<pointGroup> new_groups;
+        split_group(s, first, ce, new_groups);
+        if (new_groups.empty()) return std::vector<float>();
+        // split_group adds the greater side first.
+        return {(float)new_groups[1].size(), (float)new_groups[0].size()};
+    }
+    case solverCapture::CE_FUNCTION:
+        return findAffineFunctionPassingThroughCEOnly(s, first, ce).coeff;
+    }
+    return std::vector<float>();
+}
+
+long long percentile(std::vector<long long>& v, float q)
+{
+    if (v.empty()) return 0;
+    std::sort(v.begin(), v.end());
+    return v[std::min((int)(q*v.size()), (int)v.size() - 1)];
+}
+
+int main(int argc, char** argv)
+{
+    auto config_map = read_configuration(argc, argv);
+
+    if (argc < 2 ||
+        config_map.find("h") != config_map.end() ||
+        config_map.find("help") != config_map.end())
+    {
+        std::cout << "Usage: ./bench_solvers [options] <path_to_capture>" << std::endl;
+        std::cout << std::endl;
+        std::cout << "Options:" << std::endl;
+        std::cout << " -k <kind> | --kind <kind>: "
+                  << "Only replay calls of one kind: predicate, regression, split or ce_function." << std::endl;
+        std::cout << " -r <value> | --repeat <value>: "
+                  << "Number of times each call is replayed (default 1)." << std::endl;
+        std::cout << " -m | --max_margin: "
+                  << "Replay predicates with max margin, irrespective of the captured setting." << std::endl;
+        std::cout << " -h | --help: "
+                  << "Usage and options for the solver benchmark." << std::endl;
+        return 0;
+    }
+
+    std::string kind;
+    int repeat = 1;
+    if (config_map.find("k") != config_map.end())
+    {
+        kind = config_map["k"];
+    }
+    if (config_map.find("kind") != config_map.end())
+    {
+        kind = config_map["kind"];
+    }
+    if (config_map.find("r") != config_map.end())
+    {
+        repeat = std::stoi(config_map["r"]);
+    }
+    if (config_map.find("repeat") != config_map.end())
+    {
+        repeat = std::stoi(config_map["repeat"]);
+    }
+    std::string path_to_capture = argv[argc - 1];
+
+    captureReader reader;
+    if (!reader.open(path_to_capture)) return 1;
+    if (config_map.find("m") != config_map.end() ||
+        config_map.find("max_margin") != config_map.end())
+    {
+        max_margin = true;
+    }
+
+    std::vector<kindStats> stats(solverCapture::NUM_KINDS);
+    capturedCall call;
+    while (reader.next(call))
+    {
+        if (!kind.empty() && kind != kind_names[call.kind]) continue;
+        auto& k = stats[call.kind];
+        k.captured_us += call.time_us;
+        std::vector<float> result;
+        for (int i = 0; i < repeat; i++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            result = replay(reader.stores[call.store], call);
+            k.times_us.push_back(elapsedMicroseconds(start));
+        }
+        if (resultChanged(call.result, result)) k.changed++;
+    }
+
+    std::printf("%-12s %8s %12s %12s %10s %10s %10s %8s\n", "kind", "calls", "replay_s", "captured_s",
+                "mean_us", "p50_us", "p99_us", "changed");
+    for (int i = 0; i < solverCapture::NUM_KINDS; i++)
+    {
+        auto& k = stats[i];
+        if (k.times_us.empty()) continue;
+        long long total = 0;
+        for (auto t : k.times_us) total += t;
+        int calls = k.times_us.size()/repeat;
+        std::printf("%-12s %8d %12.3f %12.3f %10.1f %10lld %10lld %8d\n", kind_names[i], calls,
+                    total/1e6/repeat, k.captured_us/1e6, (double)total/k.times_us.size(),
+                    percentile(k.times_us, 0.5), percentile(k.times_us, 0.99), k.changed);
+    }
+    return 0;
+}
@@ -0,0 +1,77 @@
+#include "Compact.hpp"
+#include "utils.hpp"
+
+#include <iostream>
+
+// Compacts a learnt model on its training data (see Compact.hpp), and reports the size and
+// the training precision of the model before and after.
+
+int main(int argc, char** argv)
+{
+    auto config_map = read_configuration(argc, argv);
+
+    if (argc < 2 ||
+        config_map.find("h") != config_map.end() ||
+        config_map.find("help") != config_map.end())
+    {
+        std::cout << "Usage: ./compact_model -i <model_file> -t <threshold> [-o <output_model>] <train_data>" << std::endl;
+        std::cout << std::endl;
+        std::cout << "Options:" << std::endl;
+        std::cout << " -i <model_file> | --input <model_file>: "
+                  << "Model to compact." << std::endl;
+        std::cout << " -t <value> | --threshold <value>: "
+                  << "Error threshold the model is trained for." << std::endl;
+        std::cout << " -o <path> | --output <path>: "
+                  << "The file path to output the compacted model (printed if not given)." << std::endl;
+        std::cout << " -h | --help: "
+                  << "Usage and options for the tool." << std::endl;
+        return 0;
+    }
+
+    std::string model_path, output_path;
+    float threshold = 0.5;
+    if (config_map.find("i") != config_map.end())
+    {
+        model_path = config_map["i"];
+    }
+    if (config_map.find("input") != config_map.end())
+    {
+        model_path = config_map["input"];
+    }
+    if (config_map.find("t") != config_map.end())
+    {
+        threshold = std::stof(config_map["t"]);
+    }
+    if (config_map.find("threshold") != config_map.end())
+    {
+        threshold = std::stof(config_map["threshold"]);
+    }
+    if (config_map.find("o") != config_map.end())
+    {
+        output_path = config_map["o"];
+    }
+    if (config_map.find("output") != config_map.end())
+    {
+        output_path = config_map["output"];
+    }
+    std::string data_path = argv[argc - 1];
+
+    auto m = parseModelJSON(loadModelJSON(model_path));
+    auto data = loadData(data_path);
+    auto stats = compactModel(m, data, threshold);
+
+    std::cout << "Regions: " << stats.regions_before << " -> " << stats.regions_after << std::endl;
+    std::cout << "Predicates: " << stats.predicates_before << " -> " << stats.predicates_after << std::endl;
+    std::cout << "Training precision: " << stats.precision_before << " -> " << stats.precision_after << std::endl;
+
+    if (output_path.empty())
+    {
+        std::cout << "Model Output: " << std::endl;
+        outputModel(m);
+    }
+    else if (!writeJSON(outputModelJSON(m), output_path))
+    {
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,379 @@
+#include "Parallel.hpp"
+#include "PieceWiseAffineModel.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Generator for synthetic piecewise affine data-sets.
+//
+// A random piecewise affine model is generated over the input space [0, 100]^n, and
+// rows are sampled uniformly from the input space and labelled by the model (with
+// optional gaussian noise). Every value is drawn with counterRandom from (seed, row), so
+// the output only depends on the options, and rows can be generated on any number of
+// threads.
+
+// Streams used for the model, kept apart from the streams used for the rows.
+const unsigned long long MODEL_STREAM = 1ULL << 62;
+const unsigned long long SAMPLE_STREAM = MODEL_STREAM + 1024;
+const int NUM_SAMPLES = 4096;
+const int ROWS_PER_CHUNK = 1 << 16;
+
+struct generatorConfig
+{
+    long long rows = 10000;
+    long long first_row = 0;
+    int num_vars = 2;
+    int num_regions = 4;
+    std::string guard = "oblique";
+    float noise = 0.0;
+    float duplicate_rate = 0.0;
+    unsigned long long seed = 0;
+};
+
+float uniform(const generatorConfig& c, unsigned long long stream, unsigned long long counter)
+{
+    return counterRandom(c.seed, stream, counter);
+}
+
+// Predicate with random direction (a random axis for axis-aligned guards), with the
+// constant left to be set by `fitOffset`.
+predicate randomPredicate(const generatorConfig& c, unsigned long long stream)
+{
+    predicate p;
+    p.coeff.assign(c.num_vars + 1, 0.0);
+    if (c.guard == "axis")
+    {
+        int axis = std::min((int)(uniform(c, stream, 0)*c.num_vars), c.num_vars - 1);
+        p.coeff[axis] = uniform(c, stream, 1) < 0.5 ? 1.0 : -1.0;
+        return p;
+    }
+    for (int j = 0; j < c.num_vars; j++)
+        p.coeff[j] = 2*uniform(c, stream, j) - 1;
+    return p;
+}
+
+// Sets the constant of p so that it holds for (about) `count` of the sample points.
+void fitOffset(predicate& p, const std::vector<std::vector<float>>& samples, int count)
+{
+    int n = p.coeff.size() - 1;
+    std::vector<float> values;
+    for (auto& x : samples)
+    {
+        float v = 0.0;
+        for (int j = 0; j < n; j++) v += p.coeff[j]*x[j];
+        values.push_back(v);
+    }
+    if (values.empty()) return;
+    count = std::max(1, std::min(count, (int)values.size()));
+    std::sort(values.begin(), values.end(), [](float a, float b) { return a > b; });
+    // p(x) = v(x) + c >= 0 holds for the `count` largest values.
+    float cut = count < values.size() ? (values[count - 1] + values[count])/2 : values[count - 1] - 1;
+    p.coeff[n] = -cut;
+}
+
+// Generates the model as an ordered list of regions (as evaluated by the model), where
+// each guard takes an equal share of the input space left by the earlier regions. Guards
+// are a single axis-aligned or oblique predicate, or a disjunction of two oblique
+// predicates. The last region covers the rest of the input space.
+piecewiseAffineModel generateModel(const generatorConfig& c)
+{
+    piecewiseAffineModel m;
+    m.scale_vec.assign(c.num_vars, 1.0);
+
+    std::vector<std::vector<float>> samples;
+    for (int i = 0; i < NUM_SAMPLES; i++)
+    {
+        std::vector<float> x;
+        for (int j = 0; j < c.num_vars; j++)
+            x.push_back(100*uniform(c, SAMPLE_STREAM, (unsigned long long)i*c.num_vars + j));
+        samples.push_back(x);
+    }
+
+    for (int r = 0; r < c.num_regions; r++)
+    {
+        unsigned long long stream = MODEL_STREAM + 4*r;
+        piecewiseAffineModel::region region;
+        for (int j = 0; j < c.num_vars; j++)
+            region.f.coeff.push_back(4*uniform(c, stream, j) - 2);
+        region.f.coeff.push_back(100*uniform(c, stream, c.num_vars) - 50);
+
+        if (r == c.num_regions - 1)
+        {
+            region.g = true_predicate(c.num_vars);
+            m.regions.push_back(region);
+            break;
+        }
+
+        int share = samples.size()/(c.num_regions - r);
+        guardPredicate::orPredicate clause;
+        predicate p = randomPredicate(c, stream + 1);
+        fitOffset(p, samples, c.guard == "disjunctive" ? share/2 : share);
+        clause.terms.push_back(p);
+        if (c.guard == "disjunctive")
+        {
+            // The second term takes the rest of the share from the points outside the first.
+            std::vector<std::vector<float>> outside;
+            for (auto& x : samples)
+                if (!p.evaluate(x)) outside.push_back(x);
+            predicate q = randomPredicate(c, stream + 2);
+            fitOffset(q, outside, share - (samples.size() - outside.size()));
+            clause.terms.push_back(q);
+        }
+        region.g.clauses.push_back(clause);
+        m.regions.push_back(region);
+
+        std::vector<std::vector<float>> remaining;
+        for (auto& x : samples)
+            if (!region.g.evaluate(x)) remaining.push_back(x);
+        samples.swap(remaining);
+    }
+    return m;
+}
+
+// Row `row` repeats the input of an earlier row with probability `duplicate_rate`.
+long long sourceRow(const generatorConfig& c, long long row)
+{
+    while (row > 0 && uniform(c, 2*row + 1, 0) < c.duplicate_rate)
+        row = std::min((long long)(uniform(c, 2*row + 1, 1)*row), row - 1);
+    return row;
+}
+
+void generateRow(const generatorConfig& c, piecewiseAffineModel& m, long long row, float* out)
+{
+    long long source = sourceRow(c, row);
+    for (int j = 0; j < c.num_vars; j++)
+        out[j] = 100*uniform(c, 2*source, j);
+    float y = 0.0;
+    for (auto& r : m.regions)
+    {
+        if (r.g.evaluate(out, c.num_vars))
+        {
+            y = r.f.evaluate(out, c.num_vars);
+            break;
+        }
+    }
+    if (c.noise > 0)
+    {
+        // Box-Muller transform, drawn for this row (so duplicates get their own noise).
+        float u1 = uniform(c, 2*row + 1, 2), u2 = uniform(c, 2*row + 1, 3);
+        y += c.noise*std::sqrt(-2*std::log(1 - u1))*std::cos(2*M_PI*u2);
+    }
+    out[c.num_vars] = y;
+}
+
+// Appends v with 4 decimals (faster than printf for the bulk of the CSV output).
+void appendValue(std::string& s, float v)
+{
+    long long scaled = std::llround((double)v*10000);
+    if (scaled < 0)
+    {
+        s.push_back('-');
+        scaled = -scaled;
+    }
+    char buf[24];
+    int len = 0;
+    for (int i = 0; i < 4; i++, scaled /= 10)
+        buf[len++] = '0' + scaled%10;
+    buf[len++] = '.';
+    do
+    {
+        buf[len++] = '0' + scaled%10;
+        scaled /= 10;
+    } while (scaled > 0);
+    while (len > 0) s.push_back(buf[--len]);
+}
+
+int main(int argc, char** argv)
+{
+    auto config_map = read_configuration(argc, argv);
+
+    if (config_map.find("h") != config_map.end() ||
+        config_map.find("help") != config_map.end() ||
+        (config_map.find("o") == config_map.end() && config_map.find("output") == config_map.end()))
+    {
+        std::cout << "Usage: ./gen_data -o <path_to_data> [options]" << std::endl;
+        std::cout << std::endl;
+        std::cout << "Options:" << std::endl;
+        std::cout << " -o <path> | --output <path>: "
+                  << "The file path to output the data." << std::endl;
+        std::cout << " -n <value> | --rows <value>: "
+                  << "Number of rows (default 10000)." << std::endl;
+        std::cout << " -d <value> | --dim <value>: "
+                  << "Number of input variables (default 2)." << std::endl;
+        std::cout << " -r <value> | --regions <value>: "
+                  << "Number of regions of the generating model (default 4)." << std::endl;
+        std::cout << " -g <type> | --guard <type>: "
+                  << "Guards of the generating model: axis, oblique or disjunctive (default oblique)." << std::endl;
+        std::cout << " --first_row <value>: "
+                  << "Index of the first row, to generate further rows for the same model (default 0)." << std::endl;
+        std::cout << " --noise <value>: "
+                  << "Standard deviation of gaussian noise added to the output (default 0)." << std::endl;
+        std::cout << " --duplicates <value>: "
+                  << "Fraction of rows repeating the input of an earlier row (default 0)." << std::endl;
+        std::cout << " -f <format> | --format <format>: "
+                  << "Output format: csv or binary (default csv)." << std::endl;
+        std::cout << " -m <path> | --model <path>: "
+                  << "The file path to output the generating model." << std::endl;
+        std::cout << " -j <value> | --threads <value>: "
+                  << "Number of threads used to generate rows (does not change the output)." << std::endl;
+        std::cout << " --seed <value>: "
+                  << "Seed for the generated data." << std::endl;
+        std::cout << " -h | --help: "
+                  << "Usage and options for the data generation." << std::endl;
+        return 0;
+    }
+
+    generatorConfig c;
+    std::string path_to_output, path_to_model, format = "csv";
+    if (config_map.find("o") != config_map.end())
+    {
+        path_to_output = config_map["o"];
+    }
+    if (config_map.find("output") != config_map.end())
+    {
+        path_to_output = config_map["output"];
+    }
+    if (config_map.find("n") != config_map.end())
+    {
+        c.rows = std::stoll(config_map["n"]);
+    }
+    if (config_map.find("rows") != config_map.end())
+    {
+        c.rows = std::stoll(config_map["rows"]);
+    }
+    if (config_map.find("d") != config_map.end())
+    {
+        c.num_vars = std::stoi(config_map["d"]);
+    }
+    if (config_map.find("dim") != config_map.end())
+    {
+        c.num_vars = std::stoi(config_map["dim"]);
+    }
+    if (config_map.find("r") != config_map.end())
+    {
+        c.num_regions = std::stoi(config_map["r"]);
+    }
+    if (config_map.find("regions") != config_map.end())
+    {
+        c.num_regions = std::stoi(config_map["regions"]);
+    }
+    if (config_map.find("g") != config_map.end())
+    {
+        c.guard = config_map["g"];
+    }
+    if (config_map.find("guard") != config_map.end())
+    {
+        c.guard = config_map["guard"];
+    }
+    if (config_map.find("first_row") != config_map.end())
+    {
+        c.first_row = std::stoll(config_map["first_row"]);
+    }
+    if (config_map.find("noise") != config_map.end())
+    {
+        c.noise = std::stof(config_map["noise"]);
+    }
+    if (config_map.find("duplicates") != config_map.end())
+    {
+        c.duplicate_rate = std::stof(config_map["duplicates"]);
+    }
+    if (config_map.find("f") != config_map.end())
+    {
+        format = config_map["f"];
+    }
+    if (config_map.find("format") != config_map.end())
+    {
+        format = config_map["format"];
+    }
+    if (config_map.find("m") != config_map.end())
+    {
+        path_to_model = config_map["m"];
+    }
+    if (config_map.find("model") != config_map.end())
+    {
+        path_to_model = config_map["model"];
+    }
+    if (config_map.find("j") != config_map.end())
+    {
+        num_threads = std::stoi(config_map["j"]);
+    }
+    if (config_map.find("threads") != config_map.end())
+    {
+        num_threads = std::stoi(config_map["threads"]);
+    }
+    if (config_map.find("seed") != config_map.end())
+    {
+        c.seed = std::stoull(config_map["seed"]);
+    }
+    if (c.num_vars < 1 || c.num_regions < 1 || c.rows < 0 || c.first_row < 0 ||
+        (c.guard != "axis" && c.guard != "oblique" && c.guard != "disjunctive") ||
+        (format != "csv" && format != "binary"))
+    {
+        std::cerr << "Invalid options, see ./gen_data -h." << std::endl;
+        return 1;
+    }
+
+    auto m = generateModel(c);
+    if (!path_to_model.empty() && !writeJSON(outputModelJSON(m), path_to_model)) return 1;
+
+    FILE* fp = std::fopen(path_to_output.c_str(), "wb");
+    if (!fp)
+    {
+        std::cerr << "Could not open file for writing data: " << path_to_output << std::endl;
+        return 1;
+    }
+    bool binary = format == "binary";
+    if (binary)
+    {
+        binaryDataHeader header;
+        std::memcpy(header.magic, BINARY_DATA_MAGIC, sizeof(header.magic));
+        header.num_vars = c.num_vars;
+        header.rows = c.rows;
+        std::fwrite(&header, sizeof(header), 1, fp);
+    }
+
+    // Rows are generated in chunks, a batch of chunks at a time (one or more per thread),
+    // and each batch is written out in order.
+    int row_size = c.num_vars + 1;
+    long long num_chunks = (c.rows + ROWS_PER_CHUNK - 1)/ROWS_PER_CHUNK;
+    int batch_size = std::max(1, 2*num_threads);
+    std::vector<std::vector<float>> values(batch_size);
+    std::vector<std::string> text(batch_size);
+    for (long long first = 0; first < num_chunks; first += batch_size)
+    {
+        int count = std::min((long long)batch_size, num_chunks - first);
+        parallelFor(count, [&](int k)
+            {
+                long long begin = (first + k)*ROWS_PER_CHUNK;
+                long long end = std::min(begin + ROWS_PER_CHUNK, c.rows);
+                values[k].resize((end - begin)*row_size);
+                for (long long row = begin; row < end; row++)
+                    generateRow(c, m, c.first_row + row, values[k].data() + (row - begin)*row_size);
+                if (binary) return;
+                text[k].clear();
+                for (long long i = 0; i < end - begin; i++)
+                {
+                    for (int j = 0; j < row_size; j++)
+                    {
+                        appendValue(text[k], values[k][i*row_size + j]);
+                        text[k].push_back(j + 1 < row_size ? ',' : '\n');
+                    }
+                }
+            });
+        for (int k = 0; k < count; k++)
+        {
+            if (binary)
+                std::fwrite(values[k].data(), sizeof(float), values[k].size(), fp);
+            else
+                std::fwrite(text[k].data(), 1, text[k].size(), fp);
+        }
+    }
+    std::fclose(fp);
+    return 0;
+}
@@ -1,28 +1,41 @@
 #pragma once
 
 #include "PieceWiseAffineModel.hpp"
-#include <set>
+#include "PointGroup.hpp"
+#include <vector>
 
 #define NUM_ITERATIONS 100
 
+// Learn predicates that maximize the margin from the separated points, rather than any
+// feasible predicate.
+extern bool max_margin;
+
 // Learn a predicate (x*c + c0 >= 0) that separates points in p from points in n,
 // i.e. predicate is true on points in p, and false on points in n.
-predicate genPredicateUsingAlgLib(const std::set<std::vector<float>>& p,
-                                  const std::set<std::vector<float>>& n,
+predicate genPredicateUsingAlgLib(const pointStore& s,
+                                  const pointGroup& p,
+                                  const pointGroup& n,
                                   int num_vars);
 
-// Find an affine function, such that the point ce evaluates to value 0, while points in
-// g evaluate to non-zero value.
-affineFunction findAffineFunctionPassingThroughCEOnly(const std::set<std::vector<float>>& g,
-                                                      const std::vector<float>& ce);
+// Find an affine function, such that the point ce (an id in the store) evaluates to value 0,
+// while points in g evaluate to non-zero value.
+affineFunction findAffineFunctionPassingThroughCEOnly(const pointStore& s,
+                                                      const pointGroup& g,
+                                                      int ce);
 
 // Find an affine function, such that the point ce evaluates to value 0, while points in
 // g evaluate to non-zero value.
-// Alternate implementation using simple heuristics to find the affine function.
-affineFunction findAffineFunctionPassingThroughCEOnlyAlternate(const std::set<std::vector<float>>& g,
-                                                               const std::vector<float>& ce);
+// Alternate implementation using simple heuristics to find the affine function: random
+// functions are drawn from the random stream `trial` (with random_seed).
+affineFunction findAffineFunctionPassingThroughCEOnlyAlternate(const pointStore& s,
+                                                               const pointGroup& g,
+                                                               int ce, int trial);
 
-// Trains a model that fits a linear regression linear function on points given.
-// Note, the points also include the output as the last dimension.
-// Hence, the points are of dimensions (num_vars + 1).
-affineFunction trainModelUsingAlgLib(std::set<std::vector<float>>& points, int num_vars);
+// Trains a model that fits a linear regression linear function on the points given by ids
+// in the store, with the corresponding values in outputs. With weights (indexed as the
+// outputs), the squared error of each point counts as many times as its weight.
+affineFunction trainModelUsingAlgLib(const pointStore& s,
+                                     const std::vector<float>& outputs,
+                                     const std::vector<int>& ids,
+                                     int num_vars,
+                                     const std::vector<float>& weights = std::vector<float>());
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "PieceWiseAffineModel.hpp"
+#include <map>
+#include <vector>
+
+/* Domain decomposition: the normalized input space is split into cells by a k-d split of the
+ * data (the cell with the most points is split at the median of its widest input, until there
+ * are num_cells cells), and a model is learnt for each cell in parallel. The cell models are
+ * stitched into one model, with the bounds of a cell added as clauses to the guards of its
+ * regions. Before stitching, sibling cells are merged bottom-up when the model of one of them
+ * fits all the points of the other.
+ */
+extern int num_cells;
+
+piecewiseAffineModel learnModelByCells(const std::map<std::vector<float>, float>& data, float threshold);
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "PieceWiseAffineModel.hpp"
+
+#include <string>
+#include <vector>
+
+/* Training checkpoint: The state of the training that is costly to recompute, i.e. the
+ * affine functions found so far (and whether their discovery is complete), and the
+ * regions whose guards are learnt, in the order they were learnt. The remaining state
+ * (the points covered by each function and the order of the regions) is recomputed from
+ * the functions on resume. A checkpoint also records the size of the data and the
+ * threshold, so that it is not resumed on other data.
+ */
+struct trainingCheckpoint
+{
+    int num_points = 0;
+    int num_vars = 0;
+    float threshold = 0.0;
+    double output_sum = 0.0;
+
+    std::vector<affineFunction> functions;
+    bool discovery_complete = false;
+
+    // Index (in functions) and guard of the finished regions.
+    std::vector<int> region_functions;
+    std::vector<guardPredicate> region_guards;
+
+    // Whether the checkpoint was taken on the same data and threshold.
+    bool matches(const trainingCheckpoint& c) const;
+
+    // The checkpoint is written to a temporary file that replaces the previous checkpoint,
+    // so the file at path is always a complete checkpoint.
+    bool write(const std::string& path) const;
+    bool read(const std::string& path);
+};
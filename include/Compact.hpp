@@ -0,0 +1,30 @@
+#pragma once
+
+#include "PieceWiseAffineModel.hpp"
+#include <map>
+#include <vector>
+
+/* Model compaction: removes the parts of a learnt model that the training data does not need,
+ * so that predictions take fewer dot products. A change is only kept if every training point
+ * on which the model is within the threshold stays within it (so the training precision does
+ * not drop):
+ * (1) A region is dropped if the following regions fit its points.
+ * (2) Adjacent regions are merged into one region (with the disjunction of the guards, in
+ *     conjunctive form) if one of their functions fits the points of both, and the merged
+ *     guard needs fewer predicates after compaction.
+ * (3) Clauses and OR terms that the rest of a guard implies on the training data are dropped.
+ * Redundancy is checked on the training data rather than proved, so the model can change
+ * outside of the training data.
+ */
+struct compactionStats
+{
+    int regions_before, regions_after;
+    int predicates_before, predicates_after;
+    float precision_before, precision_after;
+};
+
+compactionStats compactModel(piecewiseAffineModel& m, const std::map<std::vector<float>, float>& data,
+                             float threshold);
+
+// Number of predicates (dot products) in the guards of the model.
+int countPredicates(const piecewiseAffineModel& m);
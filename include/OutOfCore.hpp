@@ -0,0 +1,41 @@
+#pragma once
+
+#include "PieceWiseAffineModel.hpp"
+#include <string>
+
+/* Out-of-core training: the data is a binary data file (see utils.hpp) that is mapped into
+ * memory, and the passes of the training (normalization, coverage of the affine functions,
+ * labelling of the points for a guard, counterexamples of a guard) stream over its rows in
+ * chunks. The rows are used as they are stored, without removing duplicate inputs.
+ *
+ * Only the points the solvers need are copied into memory: the seed points and (at most
+ * resident_points) regression points of an affine function, and the groups and
+ * counterexamples of a guard. Besides these, the training keeps one bit per row for the
+ * covered rows, and two bits per row for the labels of the current guard.
+ */
+struct mappedData
+{
+    int num_vars = 0;
+    long long rows = 0;
+    // Rows of num_vars inputs followed by the output.
+    const float* values = nullptr;
+
+    bool open(const std::string& path);
+    void close();
+    ~mappedData() { close(); }
+
+    const float* row(long long i) const { return values + i*(num_vars + 1); }
+
+private:
+    void* base = nullptr;
+    size_t length = 0;
+};
+
+// Maximum number of rows copied into memory for the regression of an affine function; the
+// rows covered by a function are evenly sampled down to this number.
+extern int resident_points;
+
+piecewiseAffineModel learnModelFromMappedData(const mappedData& data, float threshold);
+
+// Number of rows on which the error of the model is at least the threshold.
+long long mappedDataErrors(const piecewiseAffineModel& m, const mappedData& data, float threshold);
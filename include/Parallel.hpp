@@ -0,0 +1,75 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// Utilities to run independent steps of the training on multiple threads.
+
+// Number of threads used by the parallel utilities (1 runs everything on the calling thread).
+extern int num_threads;
+
+// Runs fn(i) for every i in [0, n) on at most `threads` threads. Indices are handed out to the
+// threads in increasing order, so fn must not depend on the order in which the indices are
+// processed.
+template <typename F>
+void parallelFor(int n, int threads, F fn)
+{
+    threads = std::min(threads, n);
+    if (threads <= 1)
+    {
+        for (int i = 0; i < n; i++) fn(i);
+        return;
+    }
+    std::atomic<int> next(0);
+    auto worker = [&]()
+        {
+            for (int i = next++; i < n; i = next++)
+                fn(i);
+        };
+    std::vector<std::thread> pool;
+    for (int t = 0; t < threads; t++)
+        pool.emplace_back(worker);
+    for (auto& t : pool)
+        t.join();
+}
+
+// As above, on num_threads threads.
+template <typename F>
+void parallelFor(int n, F fn)
+{
+    parallelFor(n, num_threads, fn);
+}
+
+// Returns the smallest i in [0, n) for which fn(i) is true, or n if there is none.
+// Trials run concurrently, and trials after a successful one are skipped. The result
+// is the same as running the trials one after another, irrespective of the number of
+// threads, as long as each trial only depends on its index.
+template <typename F>
+int parallelFindFirst(int n, F fn)
+{
+    int threads = std::min(num_threads, n);
+    if (threads <= 1)
+    {
+        for (int i = 0; i < n; i++)
+            if (fn(i)) return i;
+        return n;
+    }
+    std::atomic<int> next(0), found(n);
+    auto worker = [&]()
+        {
+            for (int i = next++; i < found; i = next++)
+            {
+                if (!fn(i)) continue;
+                int current = found;
+                while (i < current && !found.compare_exchange_weak(current, i));
+            }
+        };
+    std::vector<std::thread> pool;
+    for (int t = 0; t < threads; t++)
+        pool.emplace_back(worker);
+    for (auto& t : pool)
+        t.join();
+    return found;
+}
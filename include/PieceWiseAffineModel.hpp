@@ -14,14 +14,20 @@ struct affineFunction
     std::vector<float> coeff;
 
     float evaluate(const std::vector<float>& input)
+    {
+        return evaluate(input.data(), input.size());
+    }
+
+    // Evaluate on an input of n values stored contiguously.
+    float evaluate(const float* input, int n) const
     {
         float result = 0;
         if (coeff.empty()) return result;
-        for (int i = 0; i < input.size(); i++)
+        for (int i = 0; i < n; i++)
         {
             result += coeff[i]*input[i];
         }
-        result += coeff[input.size()];
+        result += coeff[n];
         return result;
     }
 
@@ -45,13 +51,18 @@ struct predicate
 {
     std::vector<float> coeff;
     bool evaluate(const std::vector<float>& input)
+    {
+        return evaluate(input.data(), input.size());
+    }
+
+    bool evaluate(const float* input, int n) const
     {
         float result = 0;
-        for (int i = 0; i < input.size(); i++)
+        for (int i = 0; i < n; i++)
         {
             result+= coeff[i]*input[i];
         }
-        result += coeff[input.size()];
+        result += coeff[n];
         return result >=  0.0;
     }
 
@@ -79,10 +90,14 @@ struct guardPredicate
     {
         std::vector<predicate> terms;
         bool evaluate(const std::vector<float>& input)
+        {
+            return evaluate(input.data(), input.size());
+        }
+        bool evaluate(const float* input, int n) const
         {
             for (auto& t : terms)
             {
-                if(t.evaluate(input))
+                if(t.evaluate(input, n))
                     return true;
             }
             return false;
@@ -99,11 +114,15 @@ struct guardPredicate
 
     std::vector<orPredicate> clauses;
     bool evaluate(const std::vector<float>& input)
+    {
+        return evaluate(input.data(), input.size());
+    }
+    bool evaluate(const float* input, int n) const
     {
         if (clauses.empty()) return false;
         for (auto& c: clauses)
         {
-            if (!c.evaluate(input))
+            if (!c.evaluate(input, n))
                 return false;
         }
         return true;
@@ -156,6 +175,16 @@ struct piecewiseAffineModel
         }
         return 0.0;
     }
+    // Evaluates the model on an input that is already normalized (divided by scale_vec).
+    float evaluateNormalized(const float* input, int n) const
+    {
+        for (auto& r : regions)
+        {
+            if (r.g.evaluate(input, n))
+                return r.f.evaluate(input, n);
+        }
+        return 0.0;
+    }
     bool operator==(const piecewiseAffineModel& m) const
     {
         if (scale_vec != m.scale_vec) return false;
@@ -0,0 +1,176 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+/* Point store: The points used while learning guards are stored once in a flat
+ * row-major array, and are referred to everywhere else by their index (id) in the
+ * store. This avoids copying the point vectors while groups are formed, merged and
+ * split.
+ */
+struct pointStore
+{
+    int num_vars;
+    std::vector<float> values;
+    // Unique id of the store (a copy is another store, a moved store keeps its id), which tells
+    // stores apart when their points are captured (see SolverCapture.hpp).
+    long long id;
+
+    pointStore(int n = 0) : num_vars(n), id(nextId()) {}
+    pointStore(const pointStore& s) : num_vars(s.num_vars), values(s.values), id(nextId()) {}
+    pointStore(pointStore&& s) = default;
+    pointStore& operator=(const pointStore& s)
+    {
+        num_vars = s.num_vars;
+        values = s.values;
+        id = nextId();
+        return *this;
+    }
+    pointStore& operator=(pointStore&& s) = default;
+
+    static long long nextId()
+    {
+        static std::atomic<long long> next_id(0);
+        return next_id++;
+    }
+
+    int size() const
+    {
+        return num_vars == 0 ? 0 : values.size()/num_vars;
+    }
+
+    const float* at(int id) const
+    {
+        return values.data() + (size_t)id*num_vars;
+    }
+
+    std::vector<float> point(int id) const
+    {
+        return std::vector<float>(at(id), at(id) + num_vars);
+    }
+
+    int add(const std::vector<float>& x)
+    {
+        values.insert(values.end(), x.begin(), x.begin() + num_vars);
+        return size() - 1;
+    }
+};
+
+/* Point group: A group of points (ids in a point store) along with bounding
+ * summaries of the group: the range of each coordinate xi, and the range of the
+ * sum xi + xj for each pair i < j (ordered (0, 1), (0, 2), ..., (1, 2), ...).
+ * The coordinate ranges are kept up to date as points are added. The pairwise
+ * ranges are only computed the first time they are needed (see `sums`), and are
+ * kept up to date after that.
+ */
+struct pointGroup
+{
+    struct bounds
+    {
+        std::vector<float> min_val, max_val;
+        std::vector<float> min_sum, max_sum;
+    };
+
+    std::vector<int> ids;
+    mutable bounds b;
+
+    pointGroup() {}
+    pointGroup(const pointStore& s, int id)
+    {
+        insert(s, id);
+    }
+    pointGroup(const pointStore& s, std::vector<int>::const_iterator begin,
+               std::vector<int>::const_iterator end)
+    {
+        for (auto it = begin; it != end; it++)
+            insert(s, *it);
+    }
+
+    int size() const { return ids.size(); }
+    bool empty() const { return ids.empty(); }
+
+    void insert(const pointStore& s, int id)
+    {
+        const float* x = s.at(id);
+        int n = s.num_vars;
+        if (ids.empty())
+        {
+            b.min_val.assign(x, x + n);
+            b.max_val.assign(x, x + n);
+            b.min_sum.clear();
+            b.max_sum.clear();
+        }
+        else
+        {
+            for (int i = 0; i < n; i++)
+            {
+                if (b.min_val[i] > x[i]) b.min_val[i] = x[i];
+                if (b.max_val[i] < x[i]) b.max_val[i] = x[i];
+            }
+        }
+        ids.push_back(id);
+        if (b.min_sum.empty()) return;
+        for (int i = 0, k = 0; i < n; i++)
+        {
+            for (int j = i + 1; j < n; j++, k++)
+            {
+                if (b.min_sum[k] > x[i] + x[j]) b.min_sum[k] = x[i] + x[j];
+                if (b.max_sum[k] < x[i] + x[j]) b.max_sum[k] = x[i] + x[j];
+            }
+        }
+    }
+
+    // Adds the points of group g, which should not share points with this group.
+    void merge(const pointGroup& g)
+    {
+        if (g.empty()) return;
+        if (empty())
+        {
+            *this = g;
+            return;
+        }
+        ids.insert(ids.end(), g.ids.begin(), g.ids.end());
+        for (int i = 0; i < b.min_val.size(); i++)
+        {
+            if (b.min_val[i] > g.b.min_val[i]) b.min_val[i] = g.b.min_val[i];
+            if (b.max_val[i] < g.b.max_val[i]) b.max_val[i] = g.b.max_val[i];
+        }
+        if (b.min_sum.empty() || g.b.min_sum.empty())
+        {
+            // Recomputed from the points when needed.
+            b.min_sum.clear();
+            b.max_sum.clear();
+            return;
+        }
+        for (int k = 0; k < b.min_sum.size(); k++)
+        {
+            if (b.min_sum[k] > g.b.min_sum[k]) b.min_sum[k] = g.b.min_sum[k];
+            if (b.max_sum[k] < g.b.max_sum[k]) b.max_sum[k] = g.b.max_sum[k];
+        }
+    }
+
+    // Returns the bounds with the pairwise ranges computed.
+    const bounds& sums(const pointStore& s) const
+    {
+        if (!b.min_sum.empty() || ids.empty()) return b;
+        int n = s.num_vars;
+        b.min_sum.assign(n*(n - 1)/2, 0.0);
+        b.max_sum.assign(n*(n - 1)/2, 0.0);
+        bool first = true;
+        for (int id : ids)
+        {
+            const float* x = s.at(id);
+            for (int i = 0, k = 0; i < n; i++)
+            {
+                for (int j = i + 1; j < n; j++, k++)
+                {
+                    if (first || b.min_sum[k] > x[i] + x[j]) b.min_sum[k] = x[i] + x[j];
+                    if (first || b.max_sum[k] < x[i] + x[j]) b.max_sum[k] = x[i] + x[j];
+                }
+            }
+            first = false;
+        }
+        return b;
+    }
+};
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "boost/json.hpp"
+
+/* Training profiler: Records the wall time of the phases of the training, and counts
+ * the calls into the solvers and the steps of the guard learning. Counters can be
+ * updated from multiple threads.
+ */
+struct trainingProfiler
+{
+    enum counter
+    {
+        LP_CALLS,
+        LP_TIME_US,
+        REGRESSION_CALLS,
+        REGRESSION_TIME_US,
+        UNIVARIATE_HITS,    // Predicates found by the xi >= c heuristic.
+        BIVARIATE_HITS,     // Predicates found by the xi + xj >= c heuristic.
+        CANDIDATE_HITS,     // Predicates found from the candidate predicates (--init).
+        LP_HITS,            // Predicates found by solving an LP.
+        CEGIS_ITERATIONS,
+        SPLITS,
+        SIMPLIFY_MERGES,
+        NUM_COUNTERS
+    };
+
+    struct regionProfile
+    {
+        int region;
+        int positive_points;
+        int negative_points;
+        double seconds;
+        long long cegis_iterations;
+        long long splits;
+    };
+
+    trainingProfiler()
+    {
+        for (int i = 0; i < NUM_COUNTERS; i++) counters[i] = 0;
+    }
+
+    void count(counter c, long long n = 1) { counters[c] += n; }
+    long long get(counter c) const { return counters[c]; }
+
+    void addPhase(const std::string& name, double seconds)
+    {
+        std::lock_guard<std::mutex> lock(m);
+        phases.emplace_back(name, seconds);
+    }
+
+    void addRegion(const regionProfile& r)
+    {
+        std::lock_guard<std::mutex> lock(m);
+        regions.push_back(r);
+    }
+
+    boost::json::object toJSON();
+
+private:
+    std::atomic<long long> counters[NUM_COUNTERS];
+    std::vector<std::pair<std::string, double>> phases;
+    std::vector<regionProfile> regions;
+    std::mutex m;
+};
+
+extern trainingProfiler profiler;
+
+// Seconds elapsed since start.
+inline double elapsedSeconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+inline long long elapsedMicroseconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+// Adds the wall time of the enclosing scope, in microseconds, to a counter.
+struct scopedTimer
+{
+    trainingProfiler::counter c;
+    std::chrono::steady_clock::time_point start;
+
+    scopedTimer(trainingProfiler::counter c) : c(c), start(std::chrono::steady_clock::now()) {}
+    ~scopedTimer() { profiler.count(c, elapsedMicroseconds(start)); }
+};
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "PieceWiseAffineModel.hpp"
+#include <cstdint>
+#include <map>
+#include <vector>
+
+/* Quantized model: an int16 copy of a learnt model for faster inference.
+ * Each normalized input xi is quantized to qi = round(xi/range_i*QUANT_MAX), where range_i is
+ * the largest |xi| in the calibration data (the training data), and clamped to +-QUANT_MAX.
+ * The coefficients of each predicate and affine function (scaled by the ranges) are quantized
+ * with a scale of their own, so that the dot products are integer dot products (pmaddwd with
+ * AVX2). A predicate a.x + b >= 0 is compared in integers against a precomputed bound, and
+ * only the output of the affine function of the region is dequantized.
+ * Quantization can move inputs near a guard boundary to the other side of it, and the outputs
+ * are within the rounding error of the coefficients, so the predictions differ slightly from
+ * the float model.
+ */
+#define QUANT_MAX 32767
+
+struct quantizedModel
+{
+    int num_vars = 0;
+    // Dot products run over rows of `stride` values (padded to a multiple of 16, unless there
+    // are fewer inputs).
+    int stride = 0;
+    // Factors of the raw inputs to their quantized values (QUANT_MAX/(scale*range)).
+    std::vector<float> input_factor;
+    // Quantized coefficients, one row per distinct predicate and then one per affine function.
+    std::vector<int16_t> weights;
+    int num_predicates = 0;
+    // Predicate rows: the predicate holds if the integer dot product is >= the bound.
+    std::vector<long long> bounds;
+    // Function rows (one per region): the output is the integer dot product times the unit
+    // plus the offset.
+    std::vector<double> units;
+    std::vector<float> offsets;
+    // Guards: the predicate rows of the terms of each clause, the end of each clause in the
+    // terms, and the end of each region in the clauses.
+    std::vector<int> terms, clause_ends, region_ends;
+
+    // Quantizes the (raw) input into `q` (of `stride` values).
+    void quantizeInput(const float* input, int16_t* q) const;
+    // Evaluates the model on the raw input, with `q` (of `stride` values) as scratch space.
+    float evaluate(const float* input, int16_t* q) const;
+};
+
+quantizedModel quantizeModel(const piecewiseAffineModel& m, const std::map<std::vector<float>, float>& calibration);
+
+// Integer dot product of two rows of `stride` values.
+long long dotInt16(const int16_t* a, const int16_t* b, int stride);
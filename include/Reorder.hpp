@@ -0,0 +1,28 @@
+#pragma once
+
+#include "PieceWiseAffineModel.hpp"
+#include "PointGroup.hpp"
+#include <map>
+#include <vector>
+
+/* Profile-guided ordering: reorders a model to reduce the expected number of predicates
+ * evaluated per prediction on a representative sample of inputs, without changing the
+ * prediction for any input:
+ * (1) The OR terms of a clause are ordered by decreasing rate of being true (on the sample
+ *     inputs that reach the guard), and the clauses of a guard by increasing expected cost
+ *     over rate of being false, so that the evaluation stops early.
+ * (2) Adjacent regions are swapped when the swap reduces the cost on the sample, but only if
+ *     their guards are disjoint (there is a clause in each whose terms are pairwise opposite
+ *     parallel half-spaces that do not overlap), so that the first matching region is the same
+ *     for every input. The fallback region stays last.
+ */
+struct reorderStats
+{
+    double cost_before, cost_after;
+    int swaps;
+};
+
+reorderStats reorderModel(piecewiseAffineModel& m, const std::map<std::vector<float>, float>& sample);
+
+// Average number of predicates evaluated per prediction on the (normalized) inputs.
+double predicateEvaluations(const piecewiseAffineModel& m, const pointStore& s);
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "PointGroup.hpp"
+
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/* Solver capture: While capturing, every call to the solver primitives (predicate LP,
+ * regression, group split and the affine function through a counterexample) is appended
+ * to a binary corpus with its inputs, its outcome and its wall time, so that the calls of
+ * a real training run can be replayed on their own (see bench_solvers).
+ *
+ * The corpus starts with a header (magic, random_seed, max_margin), followed by records
+ * that start with their kind. The same points and groups are passed to many calls, so they
+ * are written once, in STORE and GROUP records:
+ *     STORE, store (index), num_vars, offset, values (the points of the store from the
+ *            offset on: the points added to the store since its last STORE record),
+ *     GROUP, ids (of points in a store),
+ * where stores are numbered in order of their first STORE record (stores are told apart by
+ * their id, see pointStore). The calls refer to their store and to groups by their index (in
+ * order of the GROUP records):
+ *     kind, time_us, store, first (group index), rest (group index), outputs, result,
+ * where lists are written as their size followed by the values. The groups are p and n
+ * for PREDICATE, the regression points (with their outputs) and an empty group for
+ * REGRESSION, and g and {ce} for SPLIT and CE_FUNCTION. The result is the coefficients
+ * found (empty on failure), or the sizes of the two groups for SPLIT (empty if no split
+ * was found).
+ */
+#define SOLVER_CAPTURE_MAGIC "MSS2"
+
+struct capturedCall
+{
+    int kind;
+    long long time_us;
+    int store;
+    std::vector<int> first, rest;
+    std::vector<float> outputs;
+    std::vector<float> result;
+};
+
+struct solverCapture
+{
+    enum kind
+    {
+        PREDICATE,
+        REGRESSION,
+        SPLIT,
+        CE_FUNCTION,
+        NUM_KINDS,
+        STORE = NUM_KINDS,
+        GROUP
+    };
+
+    bool open(const std::string& path);
+    void close();
+    bool enabled() const { return fp != nullptr; }
+
+    // Appends a call, where the points are given as ids in the store s. Calls can be
+    // recorded from multiple threads.
+    void record(kind k, const pointStore& s, const std::vector<int>& first,
+                const std::vector<int>& rest, const std::vector<float>& outputs,
+                const std::vector<float>& result, long long time_us);
+
+private:
+    struct idsHash
+    {
+        size_t operator()(const std::vector<int>& ids) const;
+    };
+
+    int groupIndex(const std::vector<int>& ids);
+    int storeIndex(const pointStore& s);
+
+    // Captured stores (by id): their index and the number of their points written.
+    struct capturedStore
+    {
+        int index;
+        int size;
+    };
+
+    FILE* fp = nullptr;
+    std::unordered_map<long long, capturedStore> stores;
+    std::unordered_map<std::vector<int>, int, idsHash> groups;
+    std::mutex m;
+};
+
+extern solverCapture capture;
+
+// Reads the calls of a corpus in order. Opening the corpus sets random_seed and max_margin
+// to the captured values.
+struct captureReader
+{
+    // The stores of the calls (by index).
+    std::vector<pointStore> stores;
+
+    bool open(const std::string& path);
+    // Reads the next call (updating the stores when needed), or returns false at the end.
+    bool next(capturedCall& call);
+    ~captureReader();
+
+private:
+    FILE* fp = nullptr;
+    std::vector<std::vector<int>> groups;
+};
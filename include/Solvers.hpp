@@ -1,8 +1,14 @@
 #pragma once
 
 #include "PieceWiseAffineModel.hpp"
+#include "PointGroup.hpp"
 #include <algorithm>
+#include <chrono>
+#include <functional>
 #include <map>
+#include <string>
+
+struct dataSet;
 
 /* We would like to learn a piecewise affine model that can represent the dynamics
  * of a system. The piecewise affine model is amenable to analysis via formal methods
@@ -22,7 +28,86 @@
  */
 
 extern int num_splits;
+// Number of counterexamples processed per guard iteration (0 processes all of them).
+extern int ce_batch_size;
+// Maximum number of groups checked (nearest first) when merging a group during simplification
+// (0 checks all of them).
+extern int simplify_candidates;
+// Wall-clock budget for learning a model, in seconds (0 for no budget). When the budget runs
+// out, the model learnt so far is completed and returned.
+extern double time_budget;
+// Share of the time budget for the discovery of the affine functions; the rest is for the
+// guards.
+#define DISCOVERY_BUDGET_SHARE 0.4
+// Path of the training checkpoint (none if empty), written at least every checkpoint_interval
+// seconds during the discovery of affine functions and after each guard. With
+// resume_from_checkpoint, the training restarts from the checkpoint at the path.
+extern std::string checkpoint_path;
+extern double checkpoint_interval;
+extern bool resume_from_checkpoint;
+
+// Model to warm start the training from (none if it has no regions): the functions of the
+// model that still cover enough points are kept before discovering new functions, and the
+// predicates of its guards are tried as candidate_predicates when learning guards.
+extern piecewiseAffineModel initial_model;
+extern std::vector<predicate> candidate_predicates;
+
+// Splits group g (ids in the store s) into two groups that can each be separated from the
+// counterexample ce, and appends them to new_groups. Nothing is added if no split is found.
+void split_group(const pointStore& s, const pointGroup& g, int ce, std::vector<pointGroup>& new_groups);
+
+typedef std::chrono::steady_clock::time_point timePoint;
+
+// Learns a guard that separates the positive points from the negative points (ids in the
+// store s), from the groups of first_pos and first_neg. findCounterexamples(g, ces) appends
+// the points misclassified by g (id, positive), positive points first; it may add the points
+// to the store. The guard is returned as is at the deadline.
+typedef std::function<void(const guardPredicate&, std::vector<std::pair<int, bool>>&)> counterexampleFinder;
+guardPredicate genGuard(const pointStore& s, int first_pos, int first_neg,
+                        const counterexampleFinder& findCounterexamples,
+                        int num_vars, timePoint deadline);
+
+// Label of the point x (with output y) for the guard of the region with function j: 1 if it
+// is only covered by function j, -1 if it is only covered by other functions without a region
+// (has_region), and 0 otherwise.
+int labelPoint(const std::vector<affineFunction>& affineFunctions, const std::vector<char>& has_region, int j,
+               const float* x, float y, float threshold, int num_vars);
+
+// Normalizes the inputs of the data (dividing each input by its average, with NORMALIZE) into
+// the store, with the outputs in the same order. Returns the scale of each input.
+std::vector<float> normalizeInput(const std::map<std::vector<float>, float>& data,
+                                  pointStore& normalized_data,
+                                  std::vector<float>& outputs,
+                                  int num_vars);
+
+// As above, for a data set (see utils.hpp). With a scale, the inputs are divided by it instead
+// of their averages.
+std::vector<float> normalizeInput(const dataSet& data, pointStore& normalized_data, std::vector<float>& outputs,
+                                  const std::vector<float>& scale = std::vector<float>());
 
 piecewiseAffineModel learnModelFromData(const std::map<std::vector<float>, float>& data, float threshold);
+// As above, on a data set with unique inputs: the regressions and the cover of the functions
+// (which orders the regions) count each point by its weight. With a scale, the inputs are
+// normalized by it (e.g. the scale of the whole data, for a part of it).
+piecewiseAffineModel learnModelFromData(const dataSet& data, float threshold,
+                                        const std::vector<float>& scale = std::vector<float>());
+
+// Learns the model from a subsample of sample_size rows (stratified by output), and then
+// repeatedly adds the rows of the full data the model gets wrong (error above the threshold)
+// and learns again, for at most max_refinements rounds or until the training precision stops
+// improving. Returns the model with the best training precision.
+extern int sample_size;
+extern int max_refinements;
+piecewiseAffineModel learnModelFromSample(const std::map<std::vector<float>, float>& data, float threshold);
+
+// Updates the model for new rows, without retraining it: only the regions that hold for new rows
+// they get wrong are updated. Their functions are refit, or regions are added in front of them
+// for these rows (with the functions of the model that fit the rows, or new functions) and their
+// guards are learnt again. The guards are learnt on the new rows and the previous rows (the data
+// the model was learnt from, or a sample of it), and an update is kept only if it does not reduce
+// the number of these rows predicted within the threshold. Without previous rows, the regions
+// are checked against the new rows only. Returns the number of regions updated.
+int updateModel(piecewiseAffineModel& m, const std::map<std::vector<float>, float>& rows, float threshold,
+                const std::map<std::vector<float>, float>& previous = std::map<std::vector<float>, float>());
 
 piecewiseAffineModel learnModelFromTrajectories(std::vector<std::vector<std::pair<float,float>>>& trajectories, float threshold);
@@ -0,0 +1,59 @@
+#ifndef MOSAIC_H
+#define MOSAIC_H
+
+/* libmosaic: C interface to load, evaluate and train piecewise affine models in-process.
+ * Models are opaque handles. Functions that fail return NULL (or a non-zero status) and set a
+ * per-thread error message, available through mosaic_last_error(). A loaded model is not
+ * modified by evaluation, so it can be evaluated from multiple threads at once. Training uses
+ * the process-wide training configuration, so only one model is trained at a time.
+ */
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct mosaic_model mosaic_model;
+
+/* Loads a model from a JSON model file (as written by `train -o`), or from a buffer with its
+ * contents. */
+mosaic_model* mosaic_load_model_file(const char* path);
+mosaic_model* mosaic_load_model_buffer(const char* json, size_t length);
+
+/* Learns a model from `rows` rows of `num_inputs` inputs (row-major) and their outputs, within
+ * the error threshold. Rows with the same inputs keep the first output. */
+mosaic_model* mosaic_train(const float* inputs, const float* outputs, long long rows, int num_inputs,
+                           float threshold);
+
+/* Number of threads used by the training (default 1). */
+void mosaic_set_num_threads(int threads);
+
+/* Number of inputs of the model. */
+int mosaic_num_inputs(const mosaic_model* model);
+
+/* Output of the model for an input of `num_inputs` values (0 if the size does not match). */
+float mosaic_evaluate(const mosaic_model* model, const float* input, int num_inputs);
+
+/* Outputs of the model for `rows` inputs of `num_inputs` values (row-major). Returns 0, or
+ * -1 if the size of the inputs does not match the model. */
+int mosaic_evaluate_batch(const mosaic_model* model, const float* inputs, long long rows, int num_inputs,
+                          float* outputs);
+
+/* Serializes the model to JSON (the format of the model files). The string is freed with
+ * mosaic_free_string. Writes a model file; returns 0, or -1 if it cannot be written. */
+char* mosaic_model_to_json(const mosaic_model* model, size_t* length);
+int mosaic_save_model(const mosaic_model* model, const char* path);
+
+void mosaic_free_string(char* json);
+void mosaic_free_model(mosaic_model* model);
+
+/* Message of the last error on the calling thread (empty if there was none). The string is
+ * valid until the next call to the library on the thread. */
+const char* mosaic_last_error(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
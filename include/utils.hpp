@@ -9,6 +9,64 @@
 
 // Utilities for loading data and dumping the model.
 
+// Data is read from CSV files (one row per line, with the output as the last value), or
+// from binary files: a header followed by `rows` rows of `num_vars` inputs and the output,
+// stored as native floats.
+#define BINARY_DATA_MAGIC "MSD1"
+struct binaryDataHeader
+{
+    char magic[4];
+    int num_vars;
+    long long rows;
+};
+
+/* Data set: rows of `num_vars` inputs (in a flat array) with an output and a weight (the
+ * number of rows of the data file that the row stands for). Data sets built by dedupeData are
+ * in the order of their inputs (the order of a map of the inputs).
+ */
+struct dataSet
+{
+    int num_vars = 0;
+    std::vector<float> inputs;
+    std::vector<float> outputs;
+    std::vector<float> weights;
+
+    long long size() const
+    {
+        return outputs.size();
+    }
+
+    const float* at(long long row) const
+    {
+        return inputs.data() + row*num_vars;
+    }
+};
+
+// Handling of rows with the same inputs: keep the first row (with weight 1), keep one row with
+// the average output, or keep every distinct output (rows with the same input and output are
+// kept once). Except for the first, the weight of a row is the number of rows it stands for.
+enum duplicatePolicy
+{
+    KEEP_FIRST_DUPLICATE,
+    AVERAGE_DUPLICATES,
+    KEEP_ALL_DUPLICATES
+};
+
+// Removes duplicates (rows with the same bits) with a hash table, in time linear in the rows
+// (and the sort of the distinct rows).
+dataSet dedupeData(const dataSet& rows, duplicatePolicy policy);
+// Merges the rows with the same input (with conflicting outputs, after dedupeData with
+// KEEP_ALL_DUPLICATES) into a row with their weighted median output and their total weight.
+// Returns the number of merged rows.
+long long resolveConflicts(dataSet& d);
+// Policy by name: first, average or all.
+bool parseDuplicatePolicy(const std::string& name, duplicatePolicy& policy);
+dataSet loadDataSet(const std::string& path, duplicatePolicy policy);
+// Conversions between data sets and maps from the inputs to the output (with weights 1).
+std::map<std::vector<float>, float> dataMap(const dataSet& d);
+dataSet toDataSet(const std::map<std::vector<float>, float>& data);
+
+// Loads the data with the first row of rows with the same input.
 std::map<std::vector<float>, float> loadData(const std::string& path);
 
 std::string vectorString(const std::vector<float>& v);
@@ -22,16 +80,33 @@ void outputAffineFunction(const affineFunction& f,
 void outputModel(const piecewiseAffineModel& model);
 
 // JSON utilities.
+boost::json::object outputAffineFunctionJSON(const affineFunction& f);
+boost::json::object outputPredicateJSON(const guardPredicate& g);
+affineFunction parseAffineFunctionJSON(const boost::json::object& func);
+guardPredicate parseGuardPredicateJSON(const boost::json::object& func);
 boost::json::object outputModelJSON(const piecewiseAffineModel& model);
 boost::json::object loadModelJSON(const std::string& model_path);
+bool writeJSON(const boost::json::object& obj, const std::string& path);
 piecewiseAffineModel parseModelJSON(const boost::json::object& model_json);
 
 // Utilities for simple predicates.
 guardPredicate true_predicate(int n);
 guardPredicate false_predicate(int n);
 
+// Rescales the input coefficients of an affine function or predicate, from inputs normalized
+// with the scale `from` to inputs normalized with the scale `to`.
+void rescaleCoefficients(std::vector<float>& coeff, const std::vector<float>& from,
+                         const std::vector<float>& to);
+
 // Utilities for distance computation in vector space.
 float distance(const std::vector<float>& p1, const std::vector<float>& p2);
+float distance(const float* p1, const float* p2, int n);
+
+// Counter-based random numbers: returns a uniform value in [0, 1) that only depends on
+// (seed, stream, counter), so that independent trials can draw reproducible values in any
+// order and on any thread.
+extern unsigned int random_seed;
+float counterRandom(unsigned long long seed, unsigned long long stream, unsigned long long counter);
 
 // Utilities for reading input configuration.
 std::map<std::string, std::string> read_configuration(int argc, char** argv);
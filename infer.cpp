@@ -31,6 +31,7 @@ int main(int argc, char** argv)
         std::cout << "Options: " << std::endl;
         std::cout << "-i <model_file> | --input <model_file>: " << "Input model for which inference is run." << std::endl;
         std::cout << "-t <value> | --threshold <value>: " << "Error threshold to evaluate precision of the model inference." << std::endl;
+        std::cout << "--duplicates <policy>: " << "Rows with the same inputs: keep the first (first, default), average their outputs (average), or count every row (all)." << std::endl;
         std::cout << "-h | --help: " << "Usage instructions for the tool." << std::endl;
         return 0;
     }
@@ -54,23 +55,32 @@ int main(int argc, char** argv)
     {
         threshold = std::stof(config_map["threshold"].c_str());
     }
+    duplicatePolicy duplicates = KEEP_FIRST_DUPLICATE;
+    if (config_map.find("duplicates") != config_map.end())
+    {
+        if (!parseDuplicatePolicy(config_map["duplicates"], duplicates)) return 0;
+    }
     test_data_path = argv[argc - 1];
 
     auto model_json = loadModelJSON(model_path);
     auto model = parseModelJSON(model_json);
-    auto test_data = loadData(test_data_path);
+    auto test_data = loadDataSet(test_data_path, duplicates);
 
+    // Errors are counted with the weights of the rows.
     float squared_error = 0.0;
-    int error_count = 0;
-    for (auto & r : test_data)
+    double error_weight = 0.0, total_weight = 0.0;
+    for (long long r = 0; r < test_data.size(); r++)
     {
-        float val = model.evaluate(r.first);
-        // std::cout << "Expected: " << r.second << ", Inferred: " << val << std::endl;
-        squared_error += (r.second - val)*(r.second - val);
-        if (abs(val - r.second) > threshold) error_count++;
+        std::vector<float> input(test_data.at(r), test_data.at(r) + test_data.num_vars);
+        float expected = test_data.outputs[r], weight = test_data.weights[r];
+        float val = model.evaluate(input);
+        // std::cout << "Expected: " << expected << ", Inferred: " << val << std::endl;
+        squared_error += weight*(expected - val)*(expected - val);
+        if (abs(val - expected) > threshold) error_weight += weight;
+        total_weight += weight;
     }
-    squared_error = squared_error/test_data.size();
+    squared_error = squared_error/total_weight;
     std::cout << "RMSE: " << std::sqrt(squared_error) << std::endl;
-    std::cout << "Precision: " << 1 - ((float)error_count/test_data.size()) << std::endl;
+    std::cout << "Precision: " << 1 - (error_weight/total_weight) << std::endl;
     return 0;
 }
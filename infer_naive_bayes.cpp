@@ -1,7 +1,10 @@
 #include "utils.hpp"
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <fstream>
+#include <limits>
 
 // #define DEBUG
 
@@ -9,31 +12,104 @@ struct NaiveBayesModel {
     std::map<double, double> y_coeffs;
     std::map<std::pair<int, double>, double> xy_normal_mean;
     std::map<std::pair<int, double>, double> xy_normal_var;
+};
+
+// Rows evaluated together by the batched kernel.
+#define NB_BLOCK 32
+// Variances are floored at this share of the largest variance of the model, so that features
+// that are constant within a class (or the negative variances of older models) stay finite.
+#define NB_VAR_FLOOR_SHARE 1e-9
 
-    double evaluate(const std::vector<float>& input)
+/* Compiled Naive Bayes model: the model in contiguous class-major arrays, evaluated in the log
+ * domain. For class y:
+ *     log P(y) + log P(x|y) = log_norm[y] - 0.5*Sum((x_i - mean[y][i])^2*inv_var[y][i]),
+ * where log_norm[y] = log P(y) - 0.5*Sum(log(2*pi*var[y][i])). The output is the expectation of
+ * y under P(y|x), computed with log-sum-exp so that it does not underflow for unlikely inputs.
+ */
+struct compiledNaiveBayesModel
+{
+    int num_classes = 0, num_vars = 0;
+    std::vector<double> ys;
+    std::vector<double> log_norm;
+    // num_classes x num_vars.
+    std::vector<double> mean, inv_var;
+
+    // Evaluates `rows` rows (row-major, num_vars inputs each) into `values`.
+    void evaluate(const float* inputs, int rows, double* values) const
     {
-        // P(y|x) = P(y)*P(x|y)/Sum(P(y)*P(x|y))
-        // Expected value: Sum(y*P(y|x)) (alternate: value for class with maximum probability).
-        double prob_sum = 0.00000001;
-        double value = 0;
-        for (auto& y_coeff : y_coeffs)
+        std::vector<double> block((size_t)num_vars*NB_BLOCK), log_prob((size_t)num_classes*NB_BLOCK);
+        for (int start = 0; start < rows; start += NB_BLOCK)
         {
-            double y = y_coeff.first;
-            double prob = y_coeff.second;
+            int count = std::min(NB_BLOCK, rows - start);
+            // Feature-major block, so that the inner loop below runs over contiguous rows and
+            // vectorizes.
+            for (int r = 0; r < NB_BLOCK; r++)
+                for (int i = 0; i < num_vars; i++)
+                    block[(size_t)i*NB_BLOCK + r] = r < count ? inputs[(size_t)(start + r)*num_vars + i] : 0.0;
 
-            for (int i = 0; i < input.size(); i++)
+            for (int y = 0; y < num_classes; y++)
             {
-                double mean = xy_normal_mean.at(std::pair<int, double>(i, y));
-                double var = xy_normal_var.at(std::pair<int, double>(i, y));
-                prob *= std::exp(-0.5*(input.at(i) - mean)*(input.at(i) - mean)/var);
+                double* lp = log_prob.data() + (size_t)y*NB_BLOCK;
+                const double* mu = mean.data() + (size_t)y*num_vars;
+                const double* iv = inv_var.data() + (size_t)y*num_vars;
+                for (int r = 0; r < NB_BLOCK; r++) lp[r] = 0.0;
+                for (int i = 0; i < num_vars; i++)
+                {
+                    const double* x = block.data() + (size_t)i*NB_BLOCK;
+                    for (int r = 0; r < NB_BLOCK; r++)
+                    {
+                        double d = x[r] - mu[i];
+                        lp[r] += d*d*iv[i];
+                    }
+                }
+                for (int r = 0; r < NB_BLOCK; r++) lp[r] = log_norm[y] - 0.5*lp[r];
+            }
+
+            // Log-sum-exp weighted expectation of y.
+            for (int r = 0; r < count; r++)
+            {
+                double max_lp = -std::numeric_limits<double>::infinity();
+                for (int y = 0; y < num_classes; y++) max_lp = std::max(max_lp, log_prob[(size_t)y*NB_BLOCK + r]);
+                double weight_sum = 0.0, value = 0.0;
+                for (int y = 0; y < num_classes; y++)
+                {
+                    double w = std::exp(log_prob[(size_t)y*NB_BLOCK + r] - max_lp);
+                    weight_sum += w;
+                    value += ys[y]*w;
+                }
+                values[start + r] = weight_sum > 0.0 ? value/weight_sum : 0.0;
             }
-            prob_sum += prob;
-            value += y*prob;
         }
-        return value/prob_sum;
     }
 };
 
+compiledNaiveBayesModel compileNaiveBayesModel(const NaiveBayesModel& m)
+{
+    compiledNaiveBayesModel c;
+    for (auto& p : m.xy_normal_mean) c.num_vars = std::max(c.num_vars, p.first.first + 1);
+    c.num_classes = m.y_coeffs.size();
+    double max_var = 0.0;
+    for (auto& p : m.xy_normal_var) max_var = std::max(max_var, p.second);
+    double var_floor = std::max(NB_VAR_FLOOR_SHARE*max_var, (double)std::numeric_limits<float>::min());
+
+    for (auto& y_coeff : m.y_coeffs)
+    {
+        double y = y_coeff.first;
+        double log_norm = std::log(y_coeff.second);
+        c.ys.push_back(y);
+        for (int i = 0; i < c.num_vars; i++)
+        {
+            auto key = std::pair<int, double>(i, y);
+            double var = std::max(m.xy_normal_var.at(key), var_floor);
+            c.mean.push_back(m.xy_normal_mean.at(key));
+            c.inv_var.push_back(1.0/var);
+            log_norm -= 0.5*std::log(2*M_PI*var);
+        }
+        c.log_norm.push_back(log_norm);
+    }
+    return c;
+}
+
 NaiveBayesModel loadModelNaiveBayes(const std::string& model_path)
 {
     auto model_json = loadModelJSON(model_path);
@@ -115,20 +191,32 @@ int main(int argc, char** argv)
     }
     test_data_path = argv[argc - 1];
 
-    auto model = loadModelNaiveBayes(model_path);
+    auto model = compileNaiveBayesModel(loadModelNaiveBayes(model_path));
     auto test_data = loadData(test_data_path);
 
+    // The rows in a flat array, evaluated in blocks.
+    std::vector<float> inputs;
+    std::vector<double> outputs;
+    for (auto& r : test_data)
+    {
+        if (r.first.size() != model.num_vars) continue;
+        inputs.insert(inputs.end(), r.first.begin(), r.first.end());
+        outputs.push_back(r.second);
+    }
+    std::vector<double> values(outputs.size());
+    model.evaluate(inputs.data(), outputs.size(), values.data());
+
     double squared_error = 0.0;
     int error_count = 0;
-    for (auto & r : test_data)
+    for (int r = 0; r < outputs.size(); r++)
     {
-        double val = model.evaluate(r.first);
-        // std::cout << "Expected: " << r.second << ", Inferred: " << val << std::endl;
-        squared_error += (r.second - val)*(r.second - val);
-        if (abs(val - r.second) > threshold) error_count++;
+        double val = values[r];
+        // std::cout << "Expected: " << outputs[r] << ", Inferred: " << val << std::endl;
+        squared_error += (outputs[r] - val)*(outputs[r] - val);
+        if (abs(val - outputs[r]) > threshold) error_count++;
     }
-    squared_error = squared_error/test_data.size();
+    squared_error = squared_error/outputs.size();
     std::cout << "RMSE: " << std::sqrt(squared_error) << std::endl;
-    std::cout << "Precision: " << 1 - ((double)error_count/test_data.size()) << std::endl;
+    std::cout << "Precision: " << 1 - ((double)error_count/outputs.size()) << std::endl;
     return 0;
 }
@@ -0,0 +1,124 @@
+#include "Quantized.hpp"
+#include "utils.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+// Runs the float and the quantized (see Quantized.hpp) inference of a model on validation
+// data, and reports the accuracy and the throughput of both.
+
+struct inferenceReport
+{
+    double squared_error = 0.0;
+    int error_count = 0;
+    double seconds = 0.0;
+};
+
+int main(int argc, char** argv)
+{
+    auto config_map = read_configuration(argc, argv);
+
+    if (argc < 2 ||
+        config_map.find("h") != config_map.end() ||
+        config_map.find("help") != config_map.end())
+    {
+        std::cout << "Usage: ./infer_quantized -i <model_file> -t <threshold> [-c <calibration_data>] <validation_data>" << std::endl;
+        std::cout << std::endl;
+        std::cout << "Options:" << std::endl;
+        std::cout << " -i <model_file> | --input <model_file>: "
+                  << "Model to quantize." << std::endl;
+        std::cout << " -t <value> | --threshold <value>: "
+                  << "Error threshold to evaluate precision of the model inference." << std::endl;
+        std::cout << " -c <path> | --calibration <path>: "
+                  << "Data to take the input ranges from, usually the training data (default: the validation data)." << std::endl;
+        std::cout << " -h | --help: "
+                  << "Usage and options for the tool." << std::endl;
+        return 0;
+    }
+
+    std::string model_path, calibration_path;
+    float threshold = 0.5;
+    if (config_map.find("i") != config_map.end())
+    {
+        model_path = config_map["i"];
+    }
+    if (config_map.find("input") != config_map.end())
+    {
+        model_path = config_map["input"];
+    }
+    if (config_map.find("t") != config_map.end())
+    {
+        threshold = std::stof(config_map["t"]);
+    }
+    if (config_map.find("threshold") != config_map.end())
+    {
+        threshold = std::stof(config_map["threshold"]);
+    }
+    if (config_map.find("c") != config_map.end())
+    {
+        calibration_path = config_map["c"];
+    }
+    if (config_map.find("calibration") != config_map.end())
+    {
+        calibration_path = config_map["calibration"];
+    }
+    std::string data_path = argv[argc - 1];
+
+    auto m = parseModelJSON(loadModelJSON(model_path));
+    auto data = loadData(data_path);
+    auto q = calibration_path.empty() ? quantizeModel(m, data) : quantizeModel(m, loadData(calibration_path));
+
+    int n = m.scale_vec.size();
+    std::vector<float> inputs, normalized, outputs;
+    for (auto& p : data)
+    {
+        if (p.first.size() != n) continue;
+        for (int i = 0; i < n; i++)
+        {
+            inputs.push_back(p.first[i]);
+            normalized.push_back(p.first[i]/m.scale_vec[i]);
+        }
+        outputs.push_back(p.second);
+    }
+    int rows = outputs.size();
+    if (rows == 0)
+    {
+        std::cout << "No validation rows with " << n << " inputs." << std::endl;
+        return 1;
+    }
+
+    inferenceReport float_report, quantized_report;
+    std::vector<float> float_values(rows), quantized_values(rows);
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < rows; r++) float_values[r] = m.evaluateNormalized(normalized.data() + (size_t)r*n, n);
+    float_report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<int16_t> scratch(q.stride);
+    start = std::chrono::steady_clock::now();
+    for (int r = 0; r < rows; r++) quantized_values[r] = q.evaluate(inputs.data() + (size_t)r*n, scratch.data());
+    quantized_report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    int changed = 0;
+    for (int r = 0; r < rows; r++)
+    {
+        for (auto report : {std::make_pair(&float_report, float_values[r]), std::make_pair(&quantized_report, quantized_values[r])})
+        {
+            float error = report.second - outputs[r];
+            report.first->squared_error += error*error;
+            if (std::abs(error) > threshold) report.first->error_count++;
+        }
+        if (std::abs(float_values[r] - quantized_values[r]) > threshold) changed++;
+    }
+
+    for (auto report : {std::make_pair("Float", &float_report), std::make_pair("Quantized", &quantized_report)})
+    {
+        std::cout << report.first << " RMSE: " << std::sqrt(report.second->squared_error/rows)
+                  << ", Precision: " << 1 - (float)report.second->error_count/rows
+                  << ", Predictions/s: " << rows/std::max(report.second->seconds, 1e-9) << std::endl;
+    }
+    std::cout << "Precision delta: " << (float)(float_report.error_count - quantized_report.error_count)/rows << std::endl;
+    std::cout << "Predictions more than the threshold apart: " << changed << std::endl;
+    std::cout << "Model size: " << q.weights.size()*sizeof(int16_t) << " bytes of quantized coefficients" << std::endl;
+    return 0;
+}
@@ -0,0 +1,76 @@
+#include "Reorder.hpp"
+#include "utils.hpp"
+
+#include <iostream>
+
+// Reorders the regions and guards of a learnt model for a sample of inputs (see Reorder.hpp),
+// and reports the average number of predicates evaluated per prediction before and after.
+
+int main(int argc, char** argv)
+{
+    auto config_map = read_configuration(argc, argv);
+
+    if (argc < 2 ||
+        config_map.find("h") != config_map.end() ||
+        config_map.find("help") != config_map.end())
+    {
+        std::cout << "Usage: ./reorder_model -i <model_file> [-o <output_model>] <sample_data>" << std::endl;
+        std::cout << std::endl;
+        std::cout << "Options:" << std::endl;
+        std::cout << " -i <model_file> | --input <model_file>: "
+                  << "Model to reorder." << std::endl;
+        std::cout << " -o <path> | --output <path>: "
+                  << "The file path to output the reordered model (printed if not given)." << std::endl;
+        std::cout << " -h | --help: "
+                  << "Usage and options for the tool." << std::endl;
+        std::cout << "The sample data is a CSV file of inputs representative of the inference traffic "
+                  << "(in the training data format; the output column is ignored)." << std::endl;
+        return 0;
+    }
+
+    std::string model_path, output_path;
+    if (config_map.find("i") != config_map.end())
+    {
+        model_path = config_map["i"];
+    }
+    if (config_map.find("input") != config_map.end())
+    {
+        model_path = config_map["input"];
+    }
+    if (config_map.find("o") != config_map.end())
+    {
+        output_path = config_map["o"];
+    }
+    if (config_map.find("output") != config_map.end())
+    {
+        output_path = config_map["output"];
+    }
+    std::string data_path = argv[argc - 1];
+
+    auto m = parseModelJSON(loadModelJSON(model_path));
+    auto original = m;
+    auto sample = loadData(data_path);
+    auto stats = reorderModel(m, sample);
+
+    // The reordering must not change any prediction.
+    int changed = 0;
+    for (auto& p : sample)
+    {
+        if (p.first.size() != m.scale_vec.size()) continue;
+        if (original.evaluate(p.first) != m.evaluate(p.first)) changed++;
+    }
+    std::cout << "Predicates per prediction: " << stats.cost_before << " -> " << stats.cost_after << std::endl;
+    std::cout << "Region swaps: " << stats.swaps << std::endl;
+    std::cout << "Changed predictions on the sample: " << changed << std::endl;
+
+    if (output_path.empty())
+    {
+        std::cout << "Model Output: " << std::endl;
+        outputModel(m);
+    }
+    else if (!writeJSON(outputModelJSON(m), output_path))
+    {
+        return 1;
+    }
+    return 0;
+}
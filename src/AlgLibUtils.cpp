@@ -1,6 +1,9 @@
 #include "AlgLibUtils.hpp"
+#include "Profiler.hpp"
+#include "SolverCapture.hpp"
 #include "utils.hpp"
 
+#include <cmath>
 #include <functional>
 #include <iostream>
 #include "dataanalysis.h"
@@ -8,41 +11,54 @@
 
 // #define DEBUG
 
+// Global configurations
+bool max_margin = false;
+
 using namespace std;
 
-predicate genPredicateUsingAlgLib(const set<vector<float>>& p, const set<vector<float>>& n,
+// The LP, non-linear and regression solvers below are wrapped by the functions declared in
+// the header (at the end of the file), which add the profiling and the capture of the calls.
+
+static predicate solvePredicateLP(const pointStore& store, const pointGroup& p, const pointGroup& n,
                                   int num_vars)
 {
     // Set up an min LP solver.
-
 #ifdef DEBUG
     std::cerr << "Solving predicate for points." << std::endl;
 
 #endif
     int num_constraints = p.size() + n.size();
-    // cost is to maximize the distance from all points (which is quadratic generally), we set it to 0, to find
-    // a feasible solution for now.
+    // By default, the cost is set to 0 to find any feasible solution. With max_margin, an
+    // additional variable t is added (after the constant), with constraints:
+    //     x.c + c0 - t >= 0 for x in p, and x.c + c0 + t <= 0 for x in n,
+    // and the cost maximizes t. Since the coefficients are bounded by [-1, 1], t is the
+    // margin of the predicate (in L1 distance) from the closest point.
+    int num_lp_vars = max_margin ? num_vars + 2 : num_vars + 1;
     alglib::real_2d_array a;
-    a.setlength(num_constraints, num_vars + 1);
+    a.setlength(num_constraints, num_lp_vars);
 
     // Initialize constraints array.
     int i = 0;
-    for (auto& x : p)
+    for (int id : p.ids)
     {
-        for (int j = 0; j < x.size(); j++)
+        const float* x = store.at(id);
+        for (int j = 0; j < num_vars; j++)
         {
             a[i][j] = x[j];
         }
-        a[i][x.size()] = 1;
+        a[i][num_vars] = 1;
+        if (max_margin) a[i][num_vars + 1] = -1;
         i++;
     }
-    for (auto& x : n)
+    for (int id : n.ids)
     {
-        for (int j = 0; j < x.size(); j++)
+        const float* x = store.at(id);
+        for (int j = 0; j < num_vars; j++)
         {
             a[i][j] = x[j];
         }
-        a[i][x.size()] = 1;
+        a[i][num_vars] = 1;
+        if (max_margin) a[i][num_vars + 1] = 1;
         i++;
     }
 
@@ -71,24 +87,26 @@ predicate genPredicateUsingAlgLib(const set<vector<float>>& p, const set<vector<
     alglib::real_1d_array au, al;
     au.setlength(num_constraints);
     al.setlength(num_constraints);
+    // With max_margin, the slack of 0.001 is enforced as a lower bound on the margin instead.
+    float slack = max_margin ? 0.0 : 0.001;
     i = 0;
     for (int j = 0; j < p.size(); j++)
     {
-        al[i] = 0.001;
+        al[i] = slack;
         au[i] = alglib::fp_posinf;
         i++;
     }
     for (int j = 0; j < n.size(); j++)
     {
         al[i] = alglib::fp_neginf;
-        au[i] = -0.001;
+        au[i] = -slack;
         i++;
     }
 
     // Initialize variable bounds.
     alglib::real_1d_array bu, bl;
-    bu.setlength(num_vars + 1);
-    bl.setlength(num_vars + 1);
+    bu.setlength(num_lp_vars);
+    bl.setlength(num_lp_vars);
     for (int j = 0; j < num_vars; j++)
     {
         bl[j] = -1.0;
@@ -96,20 +114,27 @@ predicate genPredicateUsingAlgLib(const set<vector<float>>& p, const set<vector<
     }
     bl[num_vars] = -num_vars*max;
     bu[num_vars] = num_vars*max; // This bound is on the constant which is scaled to shift the equilibrium.
+    if (max_margin)
+    {
+        bl[num_vars + 1] = 0.001;
+        bu[num_vars + 1] = 2*num_vars*max; // Margin can not exceed the range of x.c + c0.
+    }
 
     alglib::real_1d_array s;
-    s.setlength(num_vars + 1);
+    s.setlength(num_lp_vars);
     for (int j = 0; j < num_vars; j++)
     {
         s[j] = 1.0/scale_vec[j];
     }
     s[num_vars] = 1.0;
+    if (max_margin) s[num_vars + 1] = 1.0;
     alglib::real_1d_array c;
-    c.setlength(num_vars + 1);
-    for (int j = 0; j < num_vars + 1; j++)
+    c.setlength(num_lp_vars);
+    for (int j = 0; j < num_lp_vars; j++)
     {
         c[j] = 0.0;
     }
+    if (max_margin) c[num_vars + 1] = -1.0; // Minimizing -t maximizes the margin.
     alglib::minlpstate state;
     alglib::real_1d_array x;
     alglib::minlpreport rep;
@@ -117,7 +142,7 @@ predicate genPredicateUsingAlgLib(const set<vector<float>>& p, const set<vector<
     predicate pred;
     
     try {
-        alglib::minlpcreate(num_vars + 1, state);
+        alglib::minlpcreate(num_lp_vars, state);
         // alglib::minlpsetlc(state, a, ct);
         alglib::minlpsetcost(state, c);
         alglib::minlpsetscale(state, s);
@@ -134,21 +159,15 @@ predicate genPredicateUsingAlgLib(const set<vector<float>>& p, const set<vector<
 #ifdef DEBUG
             std::cerr << "Error! Could not construct the predicate." << std::endl;
             std::cerr << "Pos Points: ";
-            for (auto &x : p)
+            for (int id : p.ids)
             {
-                std::cerr << "(";
-                for (auto j : x)
-                    std::cerr << j << ",";
-                std::cerr << "),";
+                std::cerr << vectorString(store.point(id)) << ",";
             }
             std::cerr << std::endl;
             std::cerr << "Neg Points: ";
-            for (auto &x : n)
+            for (int id : n.ids)
             {
-                std::cerr << "(";
-                for (auto j : x)
-                    std::cerr << j << ",";
-                std::cerr << "),";
+                std::cerr << vectorString(store.point(id)) << ",";
             }
             std::cerr << std::endl;
             std::cerr << "Result type: " << rep.terminationtype << std::endl;
@@ -170,7 +189,7 @@ predicate genPredicateUsingAlgLib(const set<vector<float>>& p, const set<vector<
     return pred;
 }
 
-affineFunction findAffineFunctionPassingThroughCEOnly(const set<vector<float>>& g, const vector<float>& ce)
+static affineFunction solveAffineFunctionThroughCE(const pointStore& store, const pointGroup& g, int ce_id)
 {
     // Using AlgLib.
     // We pose this as a linear programming problem where the function output on ce is 0, while
@@ -184,6 +203,7 @@ affineFunction findAffineFunctionPassingThroughCEOnly(const set<vector<float>>&
 
     affineFunction f;
     alglib::real_1d_array x1;
+    vector<float> ce = store.point(ce_id);
     try
     {
         double epsx  = 0.000001;
@@ -237,19 +257,21 @@ affineFunction findAffineFunctionPassingThroughCEOnly(const set<vector<float>>&
         alglib::minnlcsetlc2dense(state, a, al, au, 1);
 
         alglib::minnlcreport rep;
-        auto func = [&g](const alglib::real_1d_array &x, alglib::real_1d_array& fi, void* ptr)
+        auto func = [&g, &store](const alglib::real_1d_array &x, alglib::real_1d_array& fi, void*)
             {
                 int i = 0;
+                int n = store.num_vars;
                 fi[i++] = 0.0; // Target function.
-                for (auto& p : g)
+                for (int id : g.ids)
                 {
                     // (p.x)^2
+                    const float* p = store.at(id);
                     float val = 0.0;
-                    for (int k = 0; k < p.size(); k++)
+                    for (int k = 0; k < n; k++)
                     {
                         val += p[k]*x[k];
                     }
-                    val += x[p.size()];
+                    val += x[n];
                     fi[i++] = val*val;
                 }
             };
@@ -272,24 +294,26 @@ affineFunction findAffineFunctionPassingThroughCEOnly(const set<vector<float>>&
     return f;
 }
 
-affineFunction findAffineFunctionPassingThroughCEOnlyAlternate(const set<vector<float>>& g, const vector<float>& ce)
+affineFunction findAffineFunctionPassingThroughCEOnlyAlternate(const pointStore& store, const pointGroup& g, int ce_id,
+                                                               int trial)
 {
-    // Using AlgLib.
+    const float* ce = store.at(ce_id);
+    int num_vars = store.num_vars;
     for (int i = 0; i < NUM_ITERATIONS; i++)
     {
         affineFunction f;
         float ce_val = 0.0;
-        for (int j = 0; j < ce.size(); j++)
+        for (int j = 0; j < num_vars; j++)
         {
-            float c = alglib::randomreal();
-            ce_val = ce[j]*c;
+            float c = 2*counterRandom(random_seed, trial, i*num_vars + j) - 1;
+            ce_val += ce[j]*c;
             f.coeff.push_back(c);
         }
         f.coeff.push_back(-ce_val);
         bool function_found = true;
-        for (auto &p : g)
+        for (int id : g.ids)
         {
-            if (abs(f.evaluate(p)) < 0.001)
+            if (abs(f.evaluate(store.at(id), num_vars)) < 0.001)
             {
                 function_found = false;
                 break;
@@ -301,19 +325,19 @@ affineFunction findAffineFunctionPassingThroughCEOnlyAlternate(const set<vector<
     return affineFunction();
 }
 
-affineFunction trainModelUsingAlgLib(set<vector<float>>& points, int num_vars)
+static affineFunction solveRegression(const pointStore& store, const vector<float>& outputs,
+                                      const vector<int>& ids, int num_vars, const vector<float>& weights)
 {
     alglib::real_2d_array xy;
-    xy.setlength(points.size(), num_vars + 1);
-    auto it = points.begin();
-    for (int i = 0; it != points.end(); i++)
+    xy.setlength(ids.size(), num_vars + 1);
+    for (int i = 0; i < ids.size(); i++)
     {
-        auto p = *it;
-        for (int j = 0; j < p.size(); j++)
+        const float* p = store.at(ids[i]);
+        for (int j = 0; j < num_vars; j++)
         {
             xy[i][j] = p[j];
         }
-        it++;
+        xy[i][num_vars] = outputs[ids[i]];
     }
     alglib::ae_int_t nvars;
     alglib::linearmodel model;
@@ -323,7 +347,18 @@ affineFunction trainModelUsingAlgLib(set<vector<float>>& points, int num_vars)
     affineFunction f;
     try
     {
-        alglib::lrbuild(xy, points.size(), num_vars, model, rep);
+        if (weights.empty())
+        {
+            alglib::lrbuild(xy, ids.size(), num_vars, model, rep);
+        }
+        else
+        {
+            // lrbuilds minimizes Sum((e_i/s_i)^2), so a point of weight k has s_i = 1/sqrt(k).
+            alglib::real_1d_array s;
+            s.setlength(ids.size());
+            for (int i = 0; i < ids.size(); i++) s[i] = 1.0/std::sqrt(weights[ids[i]]);
+            alglib::lrbuilds(xy, s, ids.size(), num_vars, model, rep);
+        }
         alglib::lrunpack(model, c, nvars);
     }
     catch(alglib::ap_error alglib_exception)
@@ -337,3 +372,45 @@ affineFunction trainModelUsingAlgLib(set<vector<float>>& points, int num_vars)
     }
     return f;
 }
+
+predicate genPredicateUsingAlgLib(const pointStore& store, const pointGroup& p, const pointGroup& n,
+                                  int num_vars)
+{
+    profiler.count(trainingProfiler::LP_CALLS);
+    scopedTimer timer(trainingProfiler::LP_TIME_US);
+    if (!capture.enabled()) return solvePredicateLP(store, p, n, num_vars);
+
+    auto start = std::chrono::steady_clock::now();
+    predicate pred = solvePredicateLP(store, p, n, num_vars);
+    capture.record(solverCapture::PREDICATE, store, p.ids, n.ids, vector<float>(), pred.coeff,
+                   elapsedMicroseconds(start));
+    return pred;
+}
+
+affineFunction findAffineFunctionPassingThroughCEOnly(const pointStore& store, const pointGroup& g, int ce_id)
+{
+    if (!capture.enabled()) return solveAffineFunctionThroughCE(store, g, ce_id);
+
+    auto start = std::chrono::steady_clock::now();
+    affineFunction f = solveAffineFunctionThroughCE(store, g, ce_id);
+    capture.record(solverCapture::CE_FUNCTION, store, g.ids, vector<int>(1, ce_id), vector<float>(),
+                   f.coeff, elapsedMicroseconds(start));
+    return f;
+}
+
+affineFunction trainModelUsingAlgLib(const pointStore& store, const vector<float>& outputs,
+                                     const vector<int>& ids, int num_vars, const vector<float>& weights)
+{
+    profiler.count(trainingProfiler::REGRESSION_CALLS);
+    scopedTimer timer(trainingProfiler::REGRESSION_TIME_US);
+    if (!capture.enabled()) return solveRegression(store, outputs, ids, num_vars, weights);
+
+    // The weights are not captured, so weighted regressions replay unweighted.
+    auto start = std::chrono::steady_clock::now();
+    affineFunction f = solveRegression(store, outputs, ids, num_vars, weights);
+    vector<float> id_outputs;
+    for (int id : ids) id_outputs.push_back(outputs[id]);
+    capture.record(solverCapture::REGRESSION, store, ids, vector<int>(), id_outputs, f.coeff,
+                   elapsedMicroseconds(start));
+    return f;
+}
@@ -0,0 +1,231 @@
+#include "Cells.hpp"
+#include "Parallel.hpp"
+#include "Solvers.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+// Global configurations
+int num_cells = 1;
+
+// Cells with fewer points are not split further.
+#define MIN_CELL_POINTS 64
+
+using namespace std;
+
+struct cellNode
+{
+    // Points of the cell (ids in the normalized store), and the bounds of the cell.
+    vector<int> ids;
+    vector<predicate> bounds;
+    // Children of a split cell: points with x[d] <= split are in the left one.
+    int left = -1, right = -1;
+    // Model of a leaf cell, on the normalized inputs.
+    vector<piecewiseAffineModel::region> regions;
+};
+
+// Splits the cell at the median of its widest input (that has distinct values), and adds the
+// children to the nodes. Returns false if no input has distinct values.
+bool splitCell(const pointStore& s, vector<cellNode>& nodes, int node)
+{
+    int num_vars = s.num_vars;
+    vector<int> ids;
+    ids.swap(nodes[node].ids);
+
+    vector<pair<float, int>> widths;
+    for (int d = 0; d < num_vars; d++)
+    {
+        float min_val = s.at(ids[0])[d], max_val = min_val;
+        for (int id : ids)
+        {
+            min_val = std::min(min_val, s.at(id)[d]);
+            max_val = std::max(max_val, s.at(id)[d]);
+        }
+        widths.emplace_back(min_val - max_val, d);
+    }
+    std::sort(widths.begin(), widths.end());
+
+    for (auto& w : widths)
+    {
+        int d = w.second;
+        vector<float> vals;
+        for (int id : ids) vals.push_back(s.at(id)[d]);
+        std::sort(vals.begin(), vals.end());
+        // The boundary between distinct values nearest to the median.
+        int m = vals.size()/2;
+        int up = m, down = m;
+        while (up < vals.size() && vals[up] == vals[up - 1]) up++;
+        while (down > 0 && vals[down] == vals[down - 1]) down--;
+        if (up == vals.size() && down == 0) continue;
+        m = (down == 0 || (up < vals.size() && up - m <= m - down)) ? up : down;
+        float split = (vals[m - 1] + vals[m])/2;
+        if (split >= vals[m]) split = vals[m - 1];
+
+        cellNode left, right;
+        for (int id : ids)
+            (s.at(id)[d] <= split ? left : right).ids.push_back(id);
+        predicate below, above;
+        below.coeff.assign(num_vars + 1, 0.0);
+        below.coeff[d] = -1.0;
+        below.coeff[num_vars] = split;
+        above.coeff.assign(num_vars + 1, 0.0);
+        above.coeff[d] = 1.0;
+        above.coeff[num_vars] = -split;
+        left.bounds = nodes[node].bounds;
+        left.bounds.push_back(below);
+        right.bounds = nodes[node].bounds;
+        right.bounds.push_back(above);
+        nodes[node].left = nodes.size();
+        nodes.push_back(left);
+        nodes[node].right = nodes.size();
+        nodes.push_back(right);
+        return true;
+    }
+    ids.swap(nodes[node].ids);
+    return false;
+}
+
+// Whether the regions fit all the points (error below the threshold).
+bool regionsFit(const vector<piecewiseAffineModel::region>& regions, const pointStore& s,
+                const vector<float>& outputs, const vector<int>& ids, float threshold)
+{
+    piecewiseAffineModel m;
+    m.regions = regions;
+    for (int id : ids)
+        if (abs(m.evaluateNormalized(s.at(id), s.num_vars) - outputs[id]) >= threshold) return false;
+    return true;
+}
+
+piecewiseAffineModel learnModelByCells(const map<vector<float>, float>& data, float threshold)
+{
+    if (num_cells <= 1 || data.size() < 2*MIN_CELL_POINTS) return learnModelFromData(data, threshold);
+
+    int num_vars = data.begin()->first.size();
+    pointStore normalized_data;
+    vector<float> outputs;
+    piecewiseAffineModel model;
+    model.scale_vec = normalizeInput(data, normalized_data, outputs, num_vars);
+    vector<const vector<float>*> inputs;
+    for (auto& p : data) inputs.push_back(&p.first);
+
+    // Split the cell with the most points until there are num_cells cells.
+    vector<cellNode> nodes(1);
+    for (int id = 0; id < normalized_data.size(); id++) nodes[0].ids.push_back(id);
+    // Leaves that may be split, and leaves that are final.
+    vector<int> leaves(1, 0), final_leaves;
+    while (leaves.size() + final_leaves.size() < num_cells)
+    {
+        int largest = -1;
+        for (int k = 0; k < leaves.size(); k++)
+        {
+            if (largest == -1 || nodes[leaves[k]].ids.size() > nodes[leaves[largest]].ids.size())
+                largest = k;
+        }
+        if (largest == -1 || nodes[leaves[largest]].ids.size() < 2*MIN_CELL_POINTS) break;
+        int node = leaves[largest];
+        leaves.erase(leaves.begin() + largest);
+        if (!splitCell(normalized_data, nodes, node))
+        {
+            final_leaves.push_back(node);
+            continue;
+        }
+        leaves.push_back(nodes[node].left);
+        leaves.push_back(nodes[node].right);
+    }
+    leaves.insert(leaves.end(), final_leaves.begin(), final_leaves.end());
+
+    // Learn the cells in parallel, each on a single thread, with a share of the time budget
+    // (and without checkpoints or the initial model, so that the candidate predicates are
+    // cleared here and only read by the cells).
+    int threads = num_threads;
+    double budget = time_budget;
+    std::string path = checkpoint_path;
+    piecewiseAffineModel initial = initial_model;
+    if (time_budget > 0) time_budget *= std::min(1.0, (double)threads/leaves.size());
+    num_threads = 1;
+    checkpoint_path.clear();
+    initial_model = piecewiseAffineModel();
+    candidate_predicates.clear();
+    std::cerr << "Learning " << leaves.size() << " cells on " << threads << " threads." << std::endl;
+    parallelFor(leaves.size(), threads, [&](int k)
+        {
+            cellNode& cell = nodes[leaves[k]];
+            // The cells are normalized as the whole data: the average of an input over a cell
+            // can be 0 (e.g. below a split on a binary input).
+            map<vector<float>, float> cell_data;
+            for (int id : cell.ids) cell_data.emplace(*inputs[id], outputs[id]);
+            piecewiseAffineModel m = learnModelFromData(toDataSet(cell_data), threshold, model.scale_vec);
+            cell.regions = m.regions;
+        });
+    num_threads = threads;
+    time_budget = budget;
+    checkpoint_path = path;
+    initial_model = initial;
+
+    // Merge sibling cells bottom-up (children are after their parents), when the model of one
+    // fits the points of the other; the smaller model is tried first.
+    int merges = 0;
+    for (int node = nodes.size() - 1; node >= 0; node--)
+    {
+        cellNode& n = nodes[node];
+        if (n.left == -1) continue;
+        cellNode& l = nodes[n.left];
+        cellNode& r = nodes[n.right];
+        if (l.left != -1 || r.left != -1) continue;
+        cellNode* first = l.regions.size() <= r.regions.size() ? &l : &r;
+        cellNode* second = first == &l ? &r : &l;
+        cellNode* fit = nullptr;
+        if (regionsFit(first->regions, normalized_data, outputs, second->ids, threshold)) fit = first;
+        else if (regionsFit(second->regions, normalized_data, outputs, first->ids, threshold)) fit = second;
+        if (!fit) continue;
+        n.regions = fit->regions;
+        n.ids = l.ids;
+        n.ids.insert(n.ids.end(), r.ids.begin(), r.ids.end());
+        n.left = n.right = -1;
+        merges++;
+    }
+
+    // Stitch the leaves in depth-first order (left first), with the bounds of a leaf added to
+    // its guards. A point on the bound of a split satisfies the bounds of both sides, and is
+    // taken by the left one as in the split. The last leaf needs no bounds.
+    vector<int> order, stack(1, 0);
+    while (!stack.empty())
+    {
+        int node = stack.back();
+        stack.pop_back();
+        if (nodes[node].left == -1)
+        {
+            order.push_back(node);
+            continue;
+        }
+        stack.push_back(nodes[node].right);
+        stack.push_back(nodes[node].left);
+    }
+    for (int k = 0; k < order.size(); k++)
+    {
+        const cellNode& cell = nodes[order[k]];
+        bool last = k + 1 == order.size();
+        for (auto r : cell.regions)
+        {
+            // A region without a guard (genGuard failed) never holds, and would hold over the
+            // whole cell with its bounds added.
+            if (r.g.clauses.empty()) continue;
+            if (!last && !cell.bounds.empty())
+            {
+                if (r.g == true_predicate(num_vars)) r.g.clauses.clear();
+                for (auto& b : cell.bounds)
+                {
+                    guardPredicate::orPredicate clause;
+                    clause.terms.push_back(b);
+                    r.g.clauses.push_back(clause);
+                }
+            }
+            model.regions.push_back(r);
+        }
+    }
+    std::cerr << "Stitched " << order.size() << " cells (" << merges << " merges) into "
+              << model.regions.size() << " regions." << std::endl;
+    return model;
+}
@@ -0,0 +1,81 @@
+#include "Checkpoint.hpp"
+#include "utils.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+
+using namespace std;
+
+bool trainingCheckpoint::matches(const trainingCheckpoint& c) const
+{
+    return num_points == c.num_points && num_vars == c.num_vars && threshold == c.threshold &&
+           std::abs(output_sum - c.output_sum) <= 1e-6*std::max(1.0, std::abs(output_sum));
+}
+
+bool trainingCheckpoint::write(const string& path) const
+{
+    boost::json::object checkpoint_json;
+    checkpoint_json["num_points"] = num_points;
+    checkpoint_json["num_vars"] = num_vars;
+    checkpoint_json["threshold"] = threshold;
+    checkpoint_json["output_sum"] = output_sum;
+
+    boost::json::array functions_json;
+    for (auto& f : functions)
+        functions_json.push_back(outputAffineFunctionJSON(f));
+    checkpoint_json["functions"] = functions_json;
+    checkpoint_json["discovery_complete"] = discovery_complete;
+
+    boost::json::array regions_json;
+    for (int i = 0; i < region_functions.size(); i++)
+    {
+        boost::json::object region_json;
+        region_json["function"] = region_functions[i];
+        region_json["g"] = outputPredicateJSON(region_guards[i]);
+        regions_json.push_back(region_json);
+    }
+    checkpoint_json["regions"] = regions_json;
+
+    string tmp_path = path + ".tmp";
+    if (!writeJSON(checkpoint_json, tmp_path) || std::rename(tmp_path.c_str(), path.c_str()) != 0)
+    {
+        cerr << "Could not write checkpoint: " << path << endl;
+        return false;
+    }
+    return true;
+}
+
+bool trainingCheckpoint::read(const string& path)
+{
+    try
+    {
+        auto checkpoint_json = loadModelJSON(path);
+        if (checkpoint_json.empty()) return false;
+        num_points = checkpoint_json.at("num_points").as_int64();
+        num_vars = checkpoint_json.at("num_vars").as_int64();
+        threshold = checkpoint_json.at("threshold").as_double();
+        output_sum = checkpoint_json.at("output_sum").as_double();
+
+        functions.clear();
+        for (auto& f : checkpoint_json.at("functions").as_array())
+            functions.push_back(parseAffineFunctionJSON(f.as_object()));
+        discovery_complete = checkpoint_json.at("discovery_complete").as_bool();
+
+        region_functions.clear();
+        region_guards.clear();
+        for (auto& r : checkpoint_json.at("regions").as_array())
+        {
+            int j = r.as_object().at("function").as_int64();
+            if (j < 0 || j >= functions.size()) return false;
+            region_functions.push_back(j);
+            region_guards.push_back(parseGuardPredicateJSON(r.as_object().at("g").as_object()));
+        }
+    }
+    catch (std::exception& e)
+    {
+        cerr << "Invalid checkpoint: " << path << " (" << e.what() << ")" << endl;
+        return false;
+    }
+    return true;
+}
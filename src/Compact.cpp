@@ -0,0 +1,228 @@
+#include "Compact.hpp"
+#include "PointGroup.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+// Maximum number of clauses of a merged guard (the product of the clauses of the guards).
+#define MAX_MERGED_CLAUSES 16
+
+using namespace std;
+
+typedef piecewiseAffineModel::region modelRegion;
+
+int countPredicates(const piecewiseAffineModel& m)
+{
+    int count = 0;
+    for (auto& r : m.regions)
+        for (auto& c : r.g.clauses) count += c.terms.size();
+    return count;
+}
+
+// The region of a point (ids in the normalized store) in the model, and whether the model is
+// within the threshold on it, kept up to date as the regions are changed.
+struct compactor
+{
+    const pointStore& s;
+    const vector<float>& outputs;
+    float threshold;
+    piecewiseAffineModel& m;
+    vector<int> region_of;
+    vector<char> correct;
+
+    compactor(const pointStore& s, const vector<float>& outputs, float threshold, piecewiseAffineModel& m)
+        : s(s), outputs(outputs), threshold(threshold), m(m)
+    {
+        for (int id = 0; id < s.size(); id++)
+        {
+            int r = firstRegion(m.regions, id, 0);
+            region_of.push_back(r);
+            correct.push_back(fits(m.regions, r, id));
+        }
+    }
+
+    int firstRegion(const vector<modelRegion>& regions, int id, int from) const
+    {
+        for (int i = from; i < regions.size(); i++)
+            if (regions[i].g.evaluate(s.at(id), s.num_vars)) return i;
+        return regions.size();
+    }
+
+    bool fits(const vector<modelRegion>& regions, int r, int id) const
+    {
+        return r < regions.size() && abs(regions[r].f.evaluate(s.at(id), s.num_vars) - outputs[id]) < threshold;
+    }
+
+    int correctCount() const
+    {
+        int count = 0;
+        for (char c : correct) count += c;
+        return count;
+    }
+
+    // Replaces the regions of the model (which only differ from the region `from` on), if the
+    // points within the threshold stay within it.
+    bool tryRegions(const vector<modelRegion>& regions, int from)
+    {
+        vector<pair<int, int>> changes;
+        for (int id = 0; id < s.size(); id++)
+        {
+            if (region_of[id] < from) continue;
+            int r = firstRegion(regions, id, from);
+            if (correct[id] && !fits(regions, r, id)) return false;
+            changes.emplace_back(id, r);
+        }
+        m.regions = regions;
+        for (auto& c : changes)
+        {
+            region_of[c.first] = c.second;
+            correct[c.first] = fits(regions, c.second, c.first);
+        }
+        return true;
+    }
+
+    void dropRegions()
+    {
+        // The last region is kept, so that every point has a region.
+        for (int i = 0; i + 1 < m.regions.size();)
+        {
+            auto regions = m.regions;
+            regions.erase(regions.begin() + i);
+            if (!tryRegions(regions, i)) i++;
+        }
+    }
+
+    void compactGuard(int i)
+    {
+        int num_vars = s.num_vars;
+        guardPredicate always = true_predicate(num_vars);
+        for (int c = 0; c < m.regions[i].g.clauses.size();)
+        {
+            if (m.regions[i].g == always) break;
+            auto regions = m.regions;
+            auto& g = regions[i].g;
+            g.clauses.erase(g.clauses.begin() + c);
+            if (g.clauses.empty()) g = always;
+            if (!tryRegions(regions, i)) c++;
+        }
+        for (int c = 0; c < m.regions[i].g.clauses.size(); c++)
+        {
+            for (int t = 0; t < m.regions[i].g.clauses[c].terms.size();)
+            {
+                // A clause needs a term (dropping the whole clause was tried above).
+                if (m.regions[i].g.clauses[c].terms.size() == 1) break;
+                auto regions = m.regions;
+                auto& terms = regions[i].g.clauses[c].terms;
+                terms.erase(terms.begin() + t);
+                if (!tryRegions(regions, i)) t++;
+            }
+        }
+    }
+
+    // g1 OR g2 in conjunctive form: a clause (c1 OR c2) for each pair of clauses.
+    guardPredicate disjunction(const guardPredicate& g1, const guardPredicate& g2) const
+    {
+        guardPredicate always = true_predicate(s.num_vars);
+        if (g1 == always || g2 == always) return always;
+        guardPredicate g;
+        for (auto& c1 : g1.clauses)
+        {
+            for (auto& c2 : g2.clauses)
+            {
+                guardPredicate::orPredicate c = c1;
+                for (auto& t : c2.terms)
+                    if (std::find(c.terms.begin(), c.terms.end(), t) == c.terms.end()) c.terms.push_back(t);
+                g.clauses.push_back(c);
+            }
+        }
+        return g;
+    }
+
+    void mergeRegions()
+    {
+        for (int i = 0; i + 1 < m.regions.size(); i++)
+        {
+            const modelRegion& a = m.regions[i];
+            const modelRegion& b = m.regions[i + 1];
+            if (a.g.clauses.size()*b.g.clauses.size() > MAX_MERGED_CLAUSES) continue;
+            // The function of either region that fits the points of both.
+            const affineFunction* f = nullptr;
+            for (const affineFunction* candidate : {&b.f, &a.f})
+            {
+                bool fit = true;
+                for (int id = 0; id < s.size() && fit; id++)
+                {
+                    if (!correct[id] || (region_of[id] != i && region_of[id] != i + 1)) continue;
+                    if (abs(candidate->evaluate(s.at(id), s.num_vars) - outputs[id]) >= threshold) fit = false;
+                }
+                if (fit)
+                {
+                    f = candidate;
+                    break;
+                }
+            }
+            if (!f) continue;
+
+            auto saved_regions = m.regions;
+            auto saved_region_of = region_of;
+            auto saved_correct = correct;
+            int predicates = countPredicates(m);
+            auto regions = m.regions;
+            modelRegion merged;
+            merged.f = *f;
+            merged.g = disjunction(a.g, b.g);
+            regions[i] = merged;
+            regions.erase(regions.begin() + i + 1);
+            if (tryRegions(regions, i))
+            {
+                compactGuard(i);
+                if (countPredicates(m) < predicates) continue;
+            }
+            m.regions = saved_regions;
+            region_of = saved_region_of;
+            correct = saved_correct;
+        }
+    }
+};
+
+compactionStats compactModel(piecewiseAffineModel& m, const map<vector<float>, float>& data, float threshold)
+{
+    compactionStats stats;
+    stats.regions_before = m.regions.size();
+    stats.predicates_before = countPredicates(m);
+
+    int num_vars = m.scale_vec.size();
+    pointStore s(num_vars);
+    vector<float> outputs;
+    for (auto& p : data)
+    {
+        if (p.first.size() != num_vars) continue;
+        vector<float> x(num_vars);
+        for (int i = 0; i < num_vars; i++) x[i] = p.first[i]/m.scale_vec[i];
+        s.add(x);
+        outputs.push_back(p.second);
+    }
+    compactor c(s, outputs, threshold, m);
+    stats.precision_before = s.size() ? (float)c.correctCount()/s.size() : 1.0;
+
+    // Each step can enable the others, so they are repeated until the model does not change.
+    while (true)
+    {
+        int regions = m.regions.size(), predicates = countPredicates(m);
+        c.dropRegions();
+        c.mergeRegions();
+        for (int i = 0; i < m.regions.size(); i++) c.compactGuard(i);
+        if (m.regions.size() == regions && countPredicates(m) == predicates) break;
+    }
+
+    stats.regions_after = m.regions.size();
+    stats.predicates_after = countPredicates(m);
+    // Verify the compacted model on the training data from scratch.
+    int correct = 0;
+    for (int id = 0; id < s.size(); id++)
+        if (abs(m.evaluateNormalized(s.at(id), num_vars) - outputs[id]) < threshold) correct++;
+    stats.precision_after = s.size() ? (float)correct/s.size() : 1.0;
+    return stats;
+}
@@ -0,0 +1,520 @@
+#include "OutOfCore.hpp"
+#include "AlgLibUtils.hpp"
+#include "Parallel.hpp"
+#include "Profiler.hpp"
+#include "Solvers.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Global configurations
+int resident_points = 100000;
+
+// Rows per chunk of a pass (a multiple of 8, so that the chunks update disjoint bytes of the
+// row bits).
+#define CHUNK_ROWS (1 << 16)
+
+using namespace std;
+
+bool mappedData::open(const std::string& path)
+{
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        std::cerr << "Could not open file for loading data: " << path << std::endl;
+        return false;
+    }
+    struct stat st;
+    binaryDataHeader header;
+    if (fstat(fd, &st) != 0 || pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+        std::memcmp(header.magic, BINARY_DATA_MAGIC, sizeof(header.magic)) != 0)
+    {
+        std::cerr << "Out-of-core training needs binary data (see gen_data -f binary): " << path << std::endl;
+        ::close(fd);
+        return false;
+    }
+    size_t expected = sizeof(header) + (size_t)header.rows*(header.num_vars + 1)*sizeof(float);
+    if ((size_t)st.st_size < expected)
+    {
+        std::cerr << "Unexpected end of binary data in " << path << std::endl;
+        ::close(fd);
+        return false;
+    }
+    void* p = mmap(nullptr, expected, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED)
+    {
+        std::cerr << "Could not map data file: " << path << std::endl;
+        return false;
+    }
+    madvise(p, expected, MADV_SEQUENTIAL);
+    base = p;
+    length = expected;
+    num_vars = header.num_vars;
+    rows = header.rows;
+    values = (const float*)((const char*)base + sizeof(header));
+    return true;
+}
+
+void mappedData::close()
+{
+    if (base) munmap(base, length);
+    base = nullptr;
+    values = nullptr;
+    length = 0;
+    rows = 0;
+}
+
+// Runs fn(chunk, begin, end) for the chunks of rows [begin, end) of the data.
+template <typename F>
+void forEachChunk(const mappedData& d, F fn)
+{
+    int num_chunks = (d.rows + CHUNK_ROWS - 1)/CHUNK_ROWS;
+    parallelFor(num_chunks, [&](int c)
+        {
+            long long begin = (long long)c*CHUNK_ROWS;
+            fn(c, begin, std::min(d.rows, begin + CHUNK_ROWS));
+        });
+}
+
+int numChunks(const mappedData& d)
+{
+    return (d.rows + CHUNK_ROWS - 1)/CHUNK_ROWS;
+}
+
+inline void normalizeRow(const float* row, const vector<float>& scale_vec, float* x)
+{
+    for (int i = 0; i < scale_vec.size(); i++) x[i] = row[i]/scale_vec[i];
+}
+
+inline bool testBit(const vector<unsigned char>& bits, long long i)
+{
+    return (bits[i >> 3] >> (i & 7)) & 1;
+}
+
+inline void setBit(vector<unsigned char>& bits, long long i)
+{
+    bits[i >> 3] |= 1 << (i & 7);
+}
+
+// Number of rows per chunk for which select(x, y) is true (x the normalized inputs).
+template <typename F>
+vector<long long> countRows(const mappedData& d, const vector<float>& scale_vec, F select)
+{
+    vector<long long> counts(numChunks(d), 0);
+    forEachChunk(d, [&](int c, long long begin, long long end)
+        {
+            vector<float> x(d.num_vars);
+            for (long long id = begin; id < end; id++)
+            {
+                normalizeRow(d.row(id), scale_vec, x.data());
+                if (select(id, x.data(), d.row(id)[d.num_vars])) counts[c]++;
+            }
+        });
+    return counts;
+}
+
+// Adds the (normalized) rows for which select is true to the store, at most limit of them:
+// every kth row, for the smallest k that fits. counts are the counts of the rows per chunk.
+template <typename F>
+void collectRows(const mappedData& d, const vector<float>& scale_vec, F select,
+                 const vector<long long>& counts, long long limit,
+                 pointStore& s, vector<float>& outputs)
+{
+    vector<long long> first_rank(counts.size(), 0);
+    long long total = 0;
+    for (int c = 0; c < counts.size(); c++)
+    {
+        first_rank[c] = total;
+        total += counts[c];
+    }
+    long long stride = std::max(1LL, (total + limit - 1)/limit);
+    vector<vector<long long>> picked(counts.size());
+    forEachChunk(d, [&](int c, long long begin, long long end)
+        {
+            if (counts[c] == 0) return;
+            vector<float> x(d.num_vars);
+            long long rank = first_rank[c];
+            for (long long id = begin; id < end; id++)
+            {
+                normalizeRow(d.row(id), scale_vec, x.data());
+                if (!select(id, x.data(), d.row(id)[d.num_vars])) continue;
+                if (rank % stride == 0) picked[c].push_back(id);
+                rank++;
+            }
+        });
+    vector<float> x(d.num_vars);
+    for (auto& rows : picked)
+    {
+        for (long long id : rows)
+        {
+            normalizeRow(d.row(id), scale_vec, x.data());
+            s.add(x);
+            outputs.push_back(d.row(id)[d.num_vars]);
+        }
+    }
+}
+
+vector<float> streamedScale(const mappedData& d)
+{
+    vector<vector<double>> sums(numChunks(d), vector<double>(d.num_vars, 0.0));
+    forEachChunk(d, [&](int c, long long begin, long long end)
+        {
+            for (long long id = begin; id < end; id++)
+                for (int i = 0; i < d.num_vars; i++) sums[c][i] += d.row(id)[i];
+        });
+    vector<float> scale_vec(d.num_vars, 0.0);
+    for (int i = 0; i < d.num_vars; i++)
+    {
+        double sum = 0.0;
+        for (auto& chunk_sums : sums) sum += chunk_sums[i];
+        scale_vec[i] = sum/d.rows;
+    }
+    return scale_vec;
+}
+
+// As genAffineFunction, with the passes over the uncovered rows streamed over the data. The
+// seed row of the function is returned in seed.
+affineFunction streamedAffineFunction(const mappedData& d, const vector<float>& scale_vec,
+                                      const vector<unsigned char>& covered, float threshold,
+                                      long long& seed)
+{
+    int num_vars = d.num_vars;
+    seed = 0;
+    while (seed < d.rows && testBit(covered, seed)) seed++;
+    if (seed == d.rows) return affineFunction();
+    vector<float> x_p(num_vars);
+    normalizeRow(d.row(seed), scale_vec, x_p.data());
+
+    // The N + 1 uncovered rows nearest to the seed (the nearest ones of each chunk, merged).
+    int k = num_vars + 1;
+    vector<vector<pair<float, long long>>> nearest(numChunks(d));
+    forEachChunk(d, [&](int c, long long begin, long long end)
+        {
+            vector<float> x(num_vars);
+            auto& best = nearest[c];
+            for (long long id = begin; id < end; id++)
+            {
+                if (id == seed || testBit(covered, id)) continue;
+                normalizeRow(d.row(id), scale_vec, x.data());
+                pair<float, long long> candidate(distance(x_p.data(), x.data(), num_vars), id);
+                if (best.size() == k && !(candidate < best.back())) continue;
+                best.insert(std::upper_bound(best.begin(), best.end(), candidate), candidate);
+                if (best.size() > k) best.pop_back();
+            }
+        });
+    vector<pair<float, long long>> merged;
+    for (auto& best : nearest) merged.insert(merged.end(), best.begin(), best.end());
+    std::sort(merged.begin(), merged.end());
+    if (merged.size() > k) merged.resize(k);
+
+#ifdef CHECK
+    // No function found!
+    if (merged.size() < num_vars + 1)
+        return affineFunction();
+#endif
+
+    pointStore s(num_vars);
+    vector<float> outputs;
+    s.add(x_p);
+    outputs.push_back(d.row(seed)[num_vars]);
+    vector<float> x(num_vars);
+    for (auto& p : merged)
+    {
+        normalizeRow(d.row(p.second), scale_vec, x.data());
+        s.add(x);
+        outputs.push_back(d.row(p.second)[num_vars]);
+    }
+    vector<int> ids;
+    for (int id = 0; id < s.size(); id++) ids.push_back(id);
+    affineFunction l = trainModelUsingAlgLib(s, outputs, ids, num_vars);
+
+    long long points_count = ids.size();
+    while (true)
+    {
+        auto l_covered = [&](long long id, const float* x, float y)
+            {
+                return !testBit(covered, id) && abs(l.evaluate(x, num_vars) - y) < threshold;
+            };
+        auto counts = countRows(d, scale_vec, l_covered);
+        long long l_covered_count = 0;
+        for (long long c : counts) l_covered_count += c;
+        if (points_count >= l_covered_count)
+            break;
+        s = pointStore(num_vars);
+        outputs.clear();
+        collectRows(d, scale_vec, l_covered, counts, resident_points, s, outputs);
+        ids.clear();
+        for (int id = 0; id < s.size(); id++) ids.push_back(id);
+        l = trainModelUsingAlgLib(s, outputs, ids, num_vars);
+        points_count = l_covered_count;
+    }
+    return l;
+}
+
+piecewiseAffineModel learnModelFromMappedData(const mappedData& data, float threshold)
+{
+    piecewiseAffineModel model;
+
+    if (data.rows == 0) return model;
+
+    int num_vars = data.num_vars;
+    long long num_points = data.rows;
+
+    // Deadlines for the time budget.
+    auto start = std::chrono::steady_clock::now();
+    timePoint deadline = timePoint::max(), discovery_deadline = timePoint::max();
+    if (time_budget > 0)
+    {
+        auto budget = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(time_budget));
+        deadline = start + budget;
+        discovery_deadline = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            budget*DISCOVERY_BUDGET_SHARE);
+    }
+
+    auto phase_start = std::chrono::steady_clock::now();
+    auto scale_vec = streamedScale(data);
+    model.scale_vec = scale_vec;
+    profiler.addPhase("normalize", elapsedSeconds(phase_start));
+    phase_start = std::chrono::steady_clock::now();
+
+    // learn affine functions.
+    vector<affineFunction> affineFunctions;
+    vector<unsigned char> covered((num_points + 7)/8, 0);
+    long long covered_count = 0;
+    while (covered_count < num_points)
+    {
+        if (std::chrono::steady_clock::now() >= discovery_deadline)
+        {
+            std::cerr << "Time budget for affine functions reached with " << num_points - covered_count
+                      << " points not covered." << std::endl;
+            break;
+        }
+        long long seed;
+        affineFunction l = streamedAffineFunction(data, scale_vec, covered, threshold, seed);
+        if (l.coeff.empty()) break;
+        vector<long long> counts(numChunks(data), 0);
+        forEachChunk(data, [&](int c, long long begin, long long end)
+            {
+                vector<float> x(num_vars);
+                for (long long id = begin; id < end; id++)
+                {
+                    if (testBit(covered, id)) continue;
+                    normalizeRow(data.row(id), scale_vec, x.data());
+                    if (abs(l.evaluate(x.data(), num_vars) - data.row(id)[num_vars]) < threshold)
+                    {
+                        setBit(covered, id);
+                        counts[c]++;
+                    }
+                }
+            });
+        long long new_covered = 0;
+        for (long long c : counts) new_covered += c;
+        if (new_covered == 0)
+        {
+            // The regression around the seed does not fit any row (not even the seed): the
+            // seed is left to the last region, rather than looking for the same function again.
+            setBit(covered, seed);
+            covered_count++;
+            continue;
+        }
+        covered_count += new_covered;
+        affineFunctions.push_back(l);
+    }
+
+    if (affineFunctions.empty())
+    {
+        // No function could be found (too few points, or out of time): a single region with
+        // the regression over (a sample of) all points.
+        auto all = [](long long, const float*, float) { return true; };
+        pointStore s(num_vars);
+        vector<float> outputs;
+        collectRows(data, scale_vec, all, countRows(data, scale_vec, all), resident_points, s, outputs);
+        vector<int> ids;
+        for (int id = 0; id < s.size(); id++) ids.push_back(id);
+        affineFunctions.push_back(trainModelUsingAlgLib(s, outputs, ids, num_vars));
+    }
+    profiler.addPhase("affine_discovery", elapsedSeconds(phase_start));
+    phase_start = std::chrono::steady_clock::now();
+
+    int num_functions = affineFunctions.size();
+    vector<vector<long long>> chunk_cover(numChunks(data), vector<long long>(num_functions, 0));
+    forEachChunk(data, [&](int c, long long begin, long long end)
+        {
+            vector<float> x(num_vars);
+            for (long long id = begin; id < end; id++)
+            {
+                normalizeRow(data.row(id), scale_vec, x.data());
+                for (int i = 0; i < num_functions; i++)
+                {
+                    if (abs(affineFunctions[i].evaluate(x.data(), num_vars) - data.row(id)[num_vars]) < threshold)
+                        chunk_cover[c][i]++;
+                }
+            }
+        });
+    vector<long long> cover_size(num_functions, 0);
+    for (auto& counts : chunk_cover)
+        for (int i = 0; i < num_functions; i++) cover_size[i] += counts[i];
+    vector<char> has_region(num_functions, false);
+
+    // Labels of the rows for the current guard.
+    vector<unsigned char> positive((num_points + 7)/8), negative((num_points + 7)/8);
+    // At most this many counterexamples (of each label) are kept per pass of a guard.
+    int ce_limit = ce_batch_size > 0 ? std::min(ce_batch_size, num_splits + 1) : num_splits + 1;
+
+    for (int i = 0; i + 1 < num_functions; i++)
+    {
+        if (std::chrono::steady_clock::now() >= deadline)
+        {
+            std::cerr << "Time budget reached with " << num_functions - i << " regions left." << std::endl;
+            break;
+        }
+        int j = -1;
+        for (int k = 0; k < num_functions; k++)
+        {
+            if (has_region[k]) continue;
+            if (j == -1 || cover_size[j] > cover_size[k]) j = k;
+        }
+
+        std::fill(positive.begin(), positive.end(), 0);
+        std::fill(negative.begin(), negative.end(), 0);
+        vector<long long> pos_counts(numChunks(data), 0), neg_counts(numChunks(data), 0);
+        forEachChunk(data, [&](int c, long long begin, long long end)
+            {
+                vector<float> x(num_vars);
+                for (long long id = begin; id < end; id++)
+                {
+                    normalizeRow(data.row(id), scale_vec, x.data());
+                    int label = labelPoint(affineFunctions, has_region, j, x.data(), data.row(id)[num_vars],
+                                           threshold, num_vars);
+                    if (label == 1)
+                    {
+                        setBit(positive, id);
+                        pos_counts[c]++;
+                    }
+                    if (label == -1)
+                    {
+                        setBit(negative, id);
+                        neg_counts[c]++;
+                    }
+                }
+            });
+        long long pos_count = 0, neg_count = 0;
+        for (long long c : pos_counts) pos_count += c;
+        for (long long c : neg_counts) neg_count += c;
+
+        auto region_start = std::chrono::steady_clock::now();
+        long long cegis_iterations = profiler.get(trainingProfiler::CEGIS_ITERATIONS);
+        long long splits = profiler.get(trainingProfiler::SPLITS);
+        guardPredicate g;
+        if (pos_count == 0) g = false_predicate(num_vars);
+        else if (neg_count == 0) g = true_predicate(num_vars);
+        else
+        {
+            // The rows used by the guard, with their ids in the store.
+            pointStore s(num_vars);
+            unordered_map<long long, int> resident;
+            auto residentId = [&](long long row)
+                {
+                    auto it = resident.find(row);
+                    if (it != resident.end()) return it->second;
+                    vector<float> x(num_vars);
+                    normalizeRow(data.row(row), scale_vec, x.data());
+                    int id = s.add(x);
+                    resident.emplace(row, id);
+                    return id;
+                };
+            long long first_pos = 0, first_neg = 0;
+            while (!testBit(positive, first_pos)) first_pos++;
+            while (!testBit(negative, first_neg)) first_neg++;
+            int pos_id = residentId(first_pos);
+            int neg_id = residentId(first_neg);
+
+            auto findCounterexamples = [&](const guardPredicate& guard, vector<pair<int, bool>>& counterexamples)
+                {
+                    vector<vector<long long>> pos_ces(numChunks(data)), neg_ces(numChunks(data));
+                    forEachChunk(data, [&](int c, long long begin, long long end)
+                        {
+                            vector<float> x(num_vars);
+                            for (long long id = begin; id < end; id++)
+                            {
+                                bool pos = testBit(positive, id);
+                                if (!pos && !testBit(negative, id)) continue;
+                                auto& ces = pos ? pos_ces[c] : neg_ces[c];
+                                if ((int)ces.size() == ce_limit) continue;
+                                normalizeRow(data.row(id), scale_vec, x.data());
+                                if (guard.evaluate(x.data(), num_vars) != pos) ces.push_back(id);
+                            }
+                        });
+                    for (int label = 0; label < 2; label++)
+                    {
+                        int found = 0;
+                        for (auto& ces : label == 0 ? pos_ces : neg_ces)
+                        {
+                            for (long long row : ces)
+                            {
+                                if (found == ce_limit) break;
+                                counterexamples.emplace_back(residentId(row), label == 0);
+                                found++;
+                            }
+                        }
+                    }
+                };
+            g = genGuard(s, pos_id, neg_id, findCounterexamples, num_vars, deadline);
+        }
+        trainingProfiler::regionProfile region_profile;
+        region_profile.region = model.regions.size();
+        region_profile.positive_points = pos_count;
+        region_profile.negative_points = neg_count;
+        region_profile.seconds = elapsedSeconds(region_start);
+        region_profile.cegis_iterations = profiler.get(trainingProfiler::CEGIS_ITERATIONS) - cegis_iterations;
+        region_profile.splits = profiler.get(trainingProfiler::SPLITS) - splits;
+        profiler.addRegion(region_profile);
+        piecewiseAffineModel::region r;
+        r.f = affineFunctions[j];
+        r.g = g;
+        model.regions.push_back(r);
+        has_region[j] = true;
+    }
+    // Add the remaining region (the largest one, if regions were dropped).
+    int j = -1;
+    for (int k = 0; k < num_functions; k++)
+        if (!has_region[k] && (j == -1 || cover_size[j] < cover_size[k])) j = k;
+    piecewiseAffineModel::region r;
+    r.f = affineFunctions[j];
+    r.g = true_predicate(num_vars);
+    model.regions.push_back(r);
+    profiler.addPhase("guard_synthesis", elapsedSeconds(phase_start));
+
+    return model;
+}
+
+long long mappedDataErrors(const piecewiseAffineModel& m, const mappedData& data, float threshold)
+{
+    if (m.scale_vec.size() != data.num_vars) return data.rows;
+    vector<long long> errors(numChunks(data), 0);
+    forEachChunk(data, [&](int c, long long begin, long long end)
+        {
+            vector<float> x(data.num_vars);
+            for (long long id = begin; id < end; id++)
+            {
+                normalizeRow(data.row(id), m.scale_vec, x.data());
+                if (abs(m.evaluateNormalized(x.data(), data.num_vars) - data.row(id)[data.num_vars]) >= threshold)
+                    errors[c]++;
+            }
+        });
+    long long total = 0;
+    for (long long e : errors) total += e;
+    return total;
+}
@@ -0,0 +1,56 @@
+#include "Profiler.hpp"
+
+trainingProfiler profiler;
+
+boost::json::object trainingProfiler::toJSON()
+{
+    std::lock_guard<std::mutex> lock(m);
+    boost::json::object profile;
+
+    boost::json::object phases_json;
+    for (auto& p : phases)
+    {
+        // Phases recorded more than once (e.g. per cell) are accumulated.
+        double seconds = p.second;
+        if (phases_json.contains(p.first))
+            seconds += phases_json.at(p.first).as_double();
+        phases_json[p.first] = seconds;
+    }
+    profile["phases"] = phases_json;
+
+    boost::json::object lp;
+    lp["calls"] = get(LP_CALLS);
+    lp["seconds"] = get(LP_TIME_US)/1e6;
+    profile["lp"] = lp;
+
+    boost::json::object regression;
+    regression["calls"] = get(REGRESSION_CALLS);
+    regression["seconds"] = get(REGRESSION_TIME_US)/1e6;
+    profile["regression"] = regression;
+
+    boost::json::object heuristics;
+    heuristics["univariate"] = get(UNIVARIATE_HITS);
+    heuristics["bivariate"] = get(BIVARIATE_HITS);
+    heuristics["candidate"] = get(CANDIDATE_HITS);
+    heuristics["lp"] = get(LP_HITS);
+    profile["predicate_heuristic_hits"] = heuristics;
+
+    profile["cegis_iterations"] = get(CEGIS_ITERATIONS);
+    profile["splits"] = get(SPLITS);
+    profile["simplify_merges"] = get(SIMPLIFY_MERGES);
+
+    boost::json::array regions_json;
+    for (auto& r : regions)
+    {
+        boost::json::object region;
+        region["region"] = r.region;
+        region["positive_points"] = r.positive_points;
+        region["negative_points"] = r.negative_points;
+        region["seconds"] = r.seconds;
+        region["cegis_iterations"] = r.cegis_iterations;
+        region["splits"] = r.splits;
+        regions_json.push_back(region);
+    }
+    profile["regions"] = regions_json;
+    return profile;
+}
@@ -0,0 +1,164 @@
+#include "Quantized.hpp"
+
+#include <algorithm>
+#include <cmath>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+// Number of int16 values in a 256-bit vector (rows of at least as many values are padded to a
+// multiple of it).
+#define QUANT_LANES 16
+
+using namespace std;
+
+long long dotInt16(const int16_t* a, const int16_t* b, int stride)
+{
+#ifdef __AVX2__
+    // pmaddwd adds pairs of products into int32 lanes (at most 2*QUANT_MAX^2, which fits), which
+    // are widened to int64 before they are accumulated.
+    __m256i sum = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + QUANT_LANES <= stride; i += QUANT_LANES)
+    {
+        __m256i va = _mm256_loadu_si256((const __m256i*)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i*)(b + i));
+        __m256i pairs = _mm256_madd_epi16(va, vb);
+        sum = _mm256_add_epi64(sum, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(pairs)));
+        sum = _mm256_add_epi64(sum, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(pairs, 1)));
+    }
+    alignas(32) long long lanes[4];
+    _mm256_store_si256((__m256i*)lanes, sum);
+    long long total = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    // Short rows are not padded.
+    for (; i < stride; i++) total += (int)a[i]*(int)b[i];
+    return total;
+#else
+    long long sum = 0;
+    for (int i = 0; i < stride; i++) sum += (int)a[i]*(int)b[i];
+    return sum;
+#endif
+}
+
+// Quantizes the coefficients (in the normalized inputs) of a row, and returns the unit of its
+// integer dot products.
+double quantizeRow(const vector<float>& coeff, const vector<float>& range, int16_t* row)
+{
+    int n = range.size();
+    double max_weight = 0.0;
+    for (int i = 0; i < n; i++) max_weight = std::max(max_weight, std::abs((double)coeff[i]*range[i]));
+    if (max_weight == 0.0) return 1.0;
+    for (int i = 0; i < n; i++) row[i] = (int16_t)std::lround(coeff[i]*range[i]/max_weight*QUANT_MAX);
+    return max_weight/((double)QUANT_MAX*QUANT_MAX);
+}
+
+quantizedModel quantizeModel(const piecewiseAffineModel& m, const map<vector<float>, float>& calibration)
+{
+    quantizedModel q;
+    int n = m.scale_vec.size();
+    q.num_vars = n;
+    q.stride = n < QUANT_LANES ? n : (n + QUANT_LANES - 1)/QUANT_LANES*QUANT_LANES;
+
+    // The range of each normalized input on the calibration data.
+    vector<float> range(n, 0.0);
+    for (auto& p : calibration)
+    {
+        if (p.first.size() != n) continue;
+        for (int i = 0; i < n; i++) range[i] = std::max(range[i], std::abs(p.first[i]/m.scale_vec[i]));
+    }
+    for (int i = 0; i < n; i++)
+    {
+        if (range[i] == 0.0) range[i] = 1.0;
+        q.input_factor.push_back(QUANT_MAX/(m.scale_vec[i]*range[i]));
+    }
+
+    // Distinct predicates share a row.
+    map<vector<float>, int> predicate_rows;
+    vector<const predicate*> predicates;
+    for (auto& r : m.regions)
+    {
+        for (auto& c : r.g.clauses)
+        {
+            for (auto& t : c.terms)
+            {
+                auto it = predicate_rows.find(t.coeff);
+                if (it == predicate_rows.end())
+                {
+                    it = predicate_rows.emplace(t.coeff, predicates.size()).first;
+                    predicates.push_back(&t);
+                }
+                q.terms.push_back(it->second);
+            }
+            q.clause_ends.push_back(q.terms.size());
+        }
+        q.region_ends.push_back(q.clause_ends.size());
+    }
+    q.num_predicates = predicates.size();
+
+    q.weights.assign((size_t)(predicates.size() + m.regions.size())*q.stride, 0);
+    int row = 0;
+    for (auto p : predicates)
+    {
+        double unit = quantizeRow(p->coeff, range, q.weights.data() + (size_t)row*q.stride);
+        // a.x + b >= 0 if dot*unit >= -b.
+        double bound = std::ceil(-p->coeff[n]/unit);
+        bound = std::max(-9e18, std::min(9e18, bound));
+        q.bounds.push_back((long long)bound);
+        row++;
+    }
+    for (auto& r : m.regions)
+    {
+        q.units.push_back(quantizeRow(r.f.coeff, range, q.weights.data() + (size_t)row*q.stride));
+        q.offsets.push_back(r.f.coeff[n]);
+        row++;
+    }
+    return q;
+}
+
+void quantizedModel::quantizeInput(const float* input, int16_t* q) const
+{
+    // Rounded half away from zero (as the coefficients are), without a call to round() so that
+    // the loop vectorizes.
+    for (int i = 0; i < num_vars; i++)
+    {
+        float v = input[i]*input_factor[i];
+        v = v < -QUANT_MAX ? -QUANT_MAX : (v > QUANT_MAX ? QUANT_MAX : v);
+        q[i] = (int16_t)(v + (v < 0 ? -0.5f : 0.5f));
+    }
+    for (int i = num_vars; i < stride; i++) q[i] = 0;
+}
+
+float quantizedModel::evaluate(const float* input, int16_t* q) const
+{
+    quantizeInput(input, q);
+    int clause = 0, term = 0;
+    for (int r = 0; r < region_ends.size(); r++)
+    {
+        // An empty guard is false.
+        bool holds = clause < region_ends[r];
+        for (; clause < region_ends[r]; clause++)
+        {
+            bool clause_holds = false;
+            for (; term < clause_ends[clause] && !clause_holds; term++)
+            {
+                int p = terms[term];
+                clause_holds = dotInt16(weights.data() + (size_t)p*stride, q, stride) >= bounds[p];
+            }
+            term = clause_ends[clause];
+            if (!clause_holds)
+            {
+                holds = false;
+                break;
+            }
+        }
+        if (holds)
+        {
+            int f = num_predicates + r;
+            return dotInt16(weights.data() + (size_t)f*stride, q, stride)*units[r] + offsets[r];
+        }
+        // Skip the remaining clauses of the region.
+        clause = region_ends[r];
+        term = clause > 0 ? clause_ends[clause - 1] : 0;
+    }
+    return 0.0;
+}
@@ -0,0 +1,190 @@
+#include "Reorder.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// Rounds of ordering the guards and swapping regions (the rates of a guard depend on the
+// inputs that reach it, and so on the order of the regions before it).
+#define REORDER_ROUNDS 2
+// Relative gap required between opposite half-spaces to treat them as disjoint, so that
+// rounding in the evaluation of the predicates does not make both hold at the boundary.
+#define DISJOINT_MARGIN 1e-4
+
+using namespace std;
+
+// Number of predicates evaluated for the guard on the input, and whether it holds.
+int guardEvaluations(const guardPredicate& g, const float* x, int n, bool& holds)
+{
+    int count = 0;
+    holds = !g.clauses.empty();
+    for (auto& c : g.clauses)
+    {
+        bool clause = false;
+        for (auto& t : c.terms)
+        {
+            count++;
+            if (t.evaluate(x, n))
+            {
+                clause = true;
+                break;
+            }
+        }
+        if (!clause)
+        {
+            holds = false;
+            break;
+        }
+    }
+    return count;
+}
+
+double predicateEvaluations(const piecewiseAffineModel& m, const pointStore& s)
+{
+    if (s.size() == 0) return 0.0;
+    long long count = 0;
+    for (int id = 0; id < s.size(); id++)
+    {
+        for (auto& r : m.regions)
+        {
+            bool holds;
+            count += guardEvaluations(r.g, s.at(id), s.num_vars, holds);
+            if (holds) break;
+        }
+    }
+    return (double)count/s.size();
+}
+
+// Whether no input satisfies both predicates: they are opposite parallel half-spaces
+// (a.x + b >= 0 and -k*a.x + d >= 0, k > 0) with -b > d/k (by the margin).
+bool disjointPredicates(const predicate& p, const predicate& q, int n)
+{
+    float k = 0.0, norm = 0.0;
+    for (int i = 0; i < n; i++)
+    {
+        if (p.coeff[i] == 0.0 && q.coeff[i] == 0.0) continue;
+        if (p.coeff[i] == 0.0 || q.coeff[i] == 0.0) return false;
+        float ratio = -q.coeff[i]/p.coeff[i];
+        if (ratio <= 0.0 || (k != 0.0 && ratio != k)) return false;
+        k = ratio;
+        norm += abs(p.coeff[i]);
+    }
+    // Constant predicates: one of them is false.
+    if (k == 0.0) return p.coeff[n] < 0.0 || q.coeff[n] < 0.0;
+    float gap = -p.coeff[n] - q.coeff[n]/k;
+    return gap > DISJOINT_MARGIN*(norm + abs(p.coeff[n]) + abs(q.coeff[n]/k));
+}
+
+// Whether no input satisfies both guards (a sufficient condition: a clause of each with
+// pairwise disjoint terms).
+bool disjointGuards(const guardPredicate& g1, const guardPredicate& g2, int n)
+{
+    for (auto& c1 : g1.clauses)
+    {
+        for (auto& c2 : g2.clauses)
+        {
+            bool disjoint = true;
+            for (auto& t1 : c1.terms)
+                for (auto& t2 : c2.terms)
+                    if (disjoint && !disjointPredicates(t1, t2, n)) disjoint = false;
+            if (disjoint) return true;
+        }
+    }
+    return false;
+}
+
+// Orders the terms and clauses of the guard by their rates on the inputs (ids in the store).
+void orderGuard(guardPredicate& g, const pointStore& s, const vector<int>& ids)
+{
+    if (ids.empty()) return;
+    int n = s.num_vars;
+    vector<pair<double, int>> clause_order;
+    for (int c = 0; c < g.clauses.size(); c++)
+    {
+        auto& terms = g.clauses[c].terms;
+        vector<int> true_count(terms.size(), 0);
+        for (int id : ids)
+            for (int t = 0; t < terms.size(); t++)
+                if (terms[t].evaluate(s.at(id), n)) true_count[t]++;
+        vector<int> order(terms.size());
+        for (int t = 0; t < terms.size(); t++) order[t] = t;
+        std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return true_count[a] > true_count[b]; });
+        vector<predicate> ordered;
+        for (int t : order) ordered.push_back(terms[t]);
+        terms.swap(ordered);
+
+        // Expected cost and rate of being false of the ordered clause.
+        long long cost = 0;
+        int false_count = 0;
+        for (int id : ids)
+        {
+            int t = 0;
+            while (t < terms.size() && !terms[t].evaluate(s.at(id), n)) t++;
+            cost += std::min(t + 1, (int)terms.size());
+            if (t == terms.size()) false_count++;
+        }
+        double rank = false_count == 0 ? std::numeric_limits<double>::infinity() : (double)cost/false_count;
+        clause_order.emplace_back(rank, c);
+    }
+    std::stable_sort(clause_order.begin(), clause_order.end(),
+                     [](const pair<double, int>& a, const pair<double, int>& b) { return a.first < b.first; });
+    vector<guardPredicate::orPredicate> ordered;
+    for (auto& c : clause_order) ordered.push_back(g.clauses[c.second]);
+    g.clauses.swap(ordered);
+}
+
+reorderStats reorderModel(piecewiseAffineModel& m, const map<vector<float>, float>& sample)
+{
+    reorderStats stats;
+    stats.swaps = 0;
+    int n = m.scale_vec.size();
+    pointStore s(n);
+    for (auto& p : sample)
+    {
+        if (p.first.size() != n) continue;
+        vector<float> x(n);
+        for (int i = 0; i < n; i++) x[i] = p.first[i]/m.scale_vec[i];
+        s.add(x);
+    }
+    stats.cost_before = predicateEvaluations(m, s);
+
+    for (int round = 0; round < REORDER_ROUNDS; round++)
+    {
+        // The inputs that reach each guard.
+        vector<int> reaching;
+        for (int id = 0; id < s.size(); id++) reaching.push_back(id);
+        for (auto& r : m.regions)
+        {
+            orderGuard(r.g, s, reaching);
+            vector<int> rest;
+            for (int id : reaching)
+                if (!r.g.evaluate(s.at(id), n)) rest.push_back(id);
+            reaching.swap(rest);
+        }
+
+        // Swap adjacent disjoint regions while it reduces the cost (the last region stays).
+        bool swapped = true;
+        while (swapped)
+        {
+            swapped = false;
+            for (int i = 0; i + 2 < m.regions.size(); i++)
+            {
+                if (!disjointGuards(m.regions[i].g, m.regions[i + 1].g, n)) continue;
+                double cost = predicateEvaluations(m, s);
+                std::swap(m.regions[i], m.regions[i + 1]);
+                if (predicateEvaluations(m, s) < cost)
+                {
+                    swapped = true;
+                    stats.swaps++;
+                }
+                else
+                {
+                    std::swap(m.regions[i], m.regions[i + 1]);
+                }
+            }
+        }
+    }
+    stats.cost_after = predicateEvaluations(m, s);
+    return stats;
+}
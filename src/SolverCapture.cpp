@@ -0,0 +1,205 @@
+#include "SolverCapture.hpp"
+#include "AlgLibUtils.hpp"
+#include "utils.hpp"
+
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+solverCapture capture;
+
+struct captureHeader
+{
+    char magic[4];
+    unsigned int seed;
+    int max_margin;
+};
+
+template <typename T>
+static void appendValue(string& buf, const T& v)
+{
+    buf.append((const char*)&v, sizeof(T));
+}
+
+template <typename T>
+static void appendList(string& buf, const vector<T>& v)
+{
+    appendValue(buf, (int)v.size());
+    buf.append((const char*)v.data(), v.size()*sizeof(T));
+}
+
+template <typename T>
+static bool readValue(FILE* fp, T& v)
+{
+    return fread(&v, sizeof(T), 1, fp) == 1;
+}
+
+template <typename T>
+static bool readList(FILE* fp, vector<T>& v)
+{
+    int n;
+    if (!readValue(fp, n) || n < 0) return false;
+    v.resize(n);
+    return fread(v.data(), sizeof(T), n, fp) == (size_t)n;
+}
+
+bool solverCapture::open(const string& path)
+{
+    fp = fopen(path.c_str(), "wb");
+    if (!fp)
+    {
+        cerr << "Could not open file for capturing solver calls: " << path << endl;
+        return false;
+    }
+    captureHeader header;
+    memcpy(header.magic, SOLVER_CAPTURE_MAGIC, sizeof(header.magic));
+    header.seed = random_seed;
+    header.max_margin = max_margin;
+    fwrite(&header, sizeof(header), 1, fp);
+    return true;
+}
+
+void solverCapture::close()
+{
+    lock_guard<mutex> lock(m);
+    if (fp) fclose(fp);
+    fp = nullptr;
+    stores.clear();
+    groups.clear();
+}
+
+size_t solverCapture::idsHash::operator()(const vector<int>& ids) const
+{
+    size_t h = ids.size();
+    for (int id : ids) h = h*1000003 ^ id;
+    return h;
+}
+
+int solverCapture::groupIndex(const vector<int>& ids)
+{
+    auto it = groups.find(ids);
+    if (it != groups.end()) return it->second;
+    int index = groups.size();
+    groups.emplace(ids, index);
+    string buf;
+    appendValue(buf, (int)GROUP);
+    appendList(buf, ids);
+    fwrite(buf.data(), 1, buf.size(), fp);
+    return index;
+}
+
+int solverCapture::storeIndex(const pointStore& s)
+{
+    auto it = stores.find(s.id);
+    if (it == stores.end())
+    {
+        capturedStore c;
+        c.index = stores.size();
+        c.size = 0;
+        it = stores.emplace(s.id, c).first;
+    }
+    capturedStore& c = it->second;
+    if (s.size() == c.size) return c.index;
+
+    // The points are only appended to a store, so only the new points are written (all of
+    // them if the store got smaller).
+    int offset = s.size() > c.size ? c.size : 0;
+    string buf;
+    appendValue(buf, (int)STORE);
+    appendValue(buf, c.index);
+    appendValue(buf, s.num_vars);
+    appendValue(buf, offset);
+    appendValue(buf, (int)(s.values.size() - (size_t)offset*s.num_vars));
+    buf.append((const char*)(s.values.data() + (size_t)offset*s.num_vars),
+               (s.values.size() - (size_t)offset*s.num_vars)*sizeof(float));
+    fwrite(buf.data(), 1, buf.size(), fp);
+    c.size = s.size();
+    return c.index;
+}
+
+void solverCapture::record(kind k, const pointStore& s, const vector<int>& first,
+                           const vector<int>& rest, const vector<float>& outputs,
+                           const vector<float>& result, long long time_us)
+{
+    lock_guard<mutex> lock(m);
+    if (!fp) return;
+    int store_index = storeIndex(s);
+    int first_index = groupIndex(first);
+    int rest_index = groupIndex(rest);
+
+    string buf;
+    appendValue(buf, (int)k);
+    appendValue(buf, time_us);
+    appendValue(buf, store_index);
+    appendValue(buf, first_index);
+    appendValue(buf, rest_index);
+    appendList(buf, outputs);
+    appendList(buf, result);
+    fwrite(buf.data(), 1, buf.size(), fp);
+}
+
+bool captureReader::open(const string& path)
+{
+    fp = fopen(path.c_str(), "rb");
+    if (!fp)
+    {
+        cerr << "Could not open solver capture: " << path << endl;
+        return false;
+    }
+    captureHeader header;
+    if (fread(&header, sizeof(header), 1, fp) != 1 ||
+        memcmp(header.magic, SOLVER_CAPTURE_MAGIC, sizeof(header.magic)) != 0)
+    {
+        cerr << "Not a solver capture: " << path << endl;
+        return false;
+    }
+    random_seed = header.seed;
+    max_margin = header.max_margin;
+    return true;
+}
+
+bool captureReader::next(capturedCall& call)
+{
+    if (!fp) return false;
+    while (readValue(fp, call.kind))
+    {
+        if (call.kind == solverCapture::STORE)
+        {
+            int index, num_vars, offset;
+            vector<float> values;
+            if (!readValue(fp, index) || !readValue(fp, num_vars) || !readValue(fp, offset) ||
+                !readList(fp, values) || index < 0 || index > (int)stores.size() || offset < 0)
+                return false;
+            if (index == stores.size()) stores.emplace_back(num_vars);
+            pointStore& store = stores[index];
+            if (store.num_vars != num_vars || offset > store.size()) return false;
+            store.values.resize((size_t)offset*num_vars);
+            store.values.insert(store.values.end(), values.begin(), values.end());
+            continue;
+        }
+        if (call.kind == solverCapture::GROUP)
+        {
+            groups.emplace_back();
+            if (!readList(fp, groups.back())) return false;
+            continue;
+        }
+        int first_index, rest_index;
+        if (call.kind < 0 || call.kind >= solverCapture::NUM_KINDS ||
+            !readValue(fp, call.time_us) || !readValue(fp, call.store) ||
+            call.store < 0 || call.store >= (int)stores.size() ||
+            !readValue(fp, first_index) || !readValue(fp, rest_index) ||
+            !readList(fp, call.outputs) || !readList(fp, call.result) ||
+            first_index < 0 || first_index >= (int)groups.size() || rest_index < 0 || rest_index >= (int)groups.size())
+            return false;
+        call.first = groups[first_index];
+        call.rest = groups[rest_index];
+        return true;
+    }
+    return false;
+}
+
+captureReader::~captureReader()
+{
+    if (fp) fclose(fp);
+}
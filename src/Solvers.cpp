@@ -1,7 +1,13 @@
 #include "Solvers.hpp"
 #include "AlgLibUtils.hpp"
+#include "Checkpoint.hpp"
+#include "Parallel.hpp"
+#include "Profiler.hpp"
+#include "SolverCapture.hpp"
 #include "utils.hpp"
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 
 // #define DEBUG
@@ -10,22 +16,38 @@
 
 // Global configurations
 int num_splits = 60;
+int ce_batch_size = 1;
+int simplify_candidates = 0;
+double time_budget = 0.0;
+std::string checkpoint_path;
+double checkpoint_interval = 60.0;
+bool resume_from_checkpoint = false;
+int sample_size = 0;
+int max_refinements = 10;
+piecewiseAffineModel initial_model;
+std::vector<predicate> candidate_predicates;
+
+// Minimum share of the points that a function of the initial model must cover to be kept.
+#define INIT_MIN_COVER_SHARE 0.001
+
+// Minimum improvement of the training precision for another refinement round.
+#define REFINEMENT_TOLERANCE 0.0005
 
 using namespace std;
 
-void genPredicateError(const vector<float>& x, const set<vector<float>>& p,
-                       const set<vector<float>>& n, const predicate& pred)
+void genPredicateError(const pointStore& s, int x, const pointGroup& p,
+                       const pointGroup& n, const predicate& pred)
 {
-    std::cerr << "Predicate not satisfied for point: " << vectorString(x) << "!" << std::endl;
+    std::cerr << "Predicate not satisfied for point: " << vectorString(s.point(x)) << "!" << std::endl;
     std::cerr << "Set of input points: " << std::endl;
-    for (auto & e : p)
+    for (int e : p.ids)
     {
-        std::cerr << vectorString(e) << ", ";
+        std::cerr << vectorString(s.point(e)) << ", ";
     }
     std::cerr <<std::endl;
-    for (auto & e : n)
+    for (int e : n.ids)
     {
-        std::cerr << vectorString(e) << ", ";
+        std::cerr << vectorString(s.point(e)) << ", ";
     }
     std::cerr <<std::endl;
     std::cerr << "Predicate: ";
@@ -33,8 +55,9 @@ void genPredicateError(const vector<float>& x, const set<vector<float>>& p,
     std::cerr <<std::endl;
 }
 
-guardPredicate genPredicate(const set<vector<float>>& p,
-                            const set<vector<float>>& n,
+guardPredicate genPredicate(const pointStore& s,
+                            const pointGroup& p,
+                            const pointGroup& n,
                             int num_vars)
 {
     bool found = false;
@@ -44,21 +67,11 @@ guardPredicate genPredicate(const set<vector<float>>& p,
     if (n.size() == 0) return true_predicate(num_vars);
 
     // Try simple heuristics: xi >= n for satisfiability.
+    // The ranges of xi are available from the group summaries.
     for (int i = 0; i < num_vars; i++)
     {
-        float max_p = p.begin()->at(i), min_p = p.begin()->at(i);
-        float max_n = n.begin()->at(i), min_n = n.begin()->at(i);
-        for (auto & x: p)
-        {
-            if (max_p < x[i]) max_p = x[i];
-            if (min_p > x[i]) min_p = x[i];
-        }
-
-        for (auto & x: n)
-        {
-            if (max_n < x[i]) max_n = x[i];
-            if (min_n > x[i]) min_n = x[i];
-        }
+        float max_p = p.b.max_val[i], min_p = p.b.min_val[i];
+        float max_n = n.b.max_val[i], min_n = n.b.min_val[i];
 
         if (max_p >= min_n && max_n >= min_p) continue;
 
@@ -76,31 +89,23 @@ guardPredicate genPredicate(const set<vector<float>>& p,
             pred.coeff.push_back((min_n + max_p)/2);
         }
         found = true;
+        profiler.count(trainingProfiler::UNIVARIATE_HITS);
         break;
     }
 
 #ifdef NORMALIZE
     // Another heuristic: xi + xj >= n.
     if (!found)
-        for (int i = 0; i < num_vars; i++)
+    {
+        auto& p_bounds = p.sums(s);
+        auto& n_bounds = n.sums(s);
+        for (int i = 0, ij = 0; i < num_vars; i++)
         {
-            for (int j = i+1; j < num_vars; j++)
+            for (int j = i+1; j < num_vars; j++, ij++)
             {
-                float max_p = p.begin()->at(i) + p.begin()->at(j);
-                float min_p = p.begin()->at(i) + p.begin()->at(j);
-                float max_n = n.begin()->at(i) + n.begin()->at(j);
-                float min_n = n.begin()->at(i) + n.begin()->at(j);
+                float max_p = p_bounds.max_sum[ij], min_p = p_bounds.min_sum[ij];
+                float max_n = n_bounds.max_sum[ij], min_n = n_bounds.min_sum[ij];
 
-                for (auto & x : p)
-                {
-                    if (max_p < x[i] + x[j]) max_p = x[i] + x[j];
-                    if (min_p > x[i] + x[j]) min_p = x[i] + x[j];
-                }
-                for (auto & x : n)
-                {
-                    if (max_n < x[i] + x[j]) max_n = x[i] + x[j];
-                    if (min_n > x[i] + x[j]) min_n = x[i] + x[j];
-                }
                 if (max_p >= min_n && max_n >= min_p) continue;
 
                 for (int k = 0; k < num_vars; k++) pred.coeff.push_back(0.0);
@@ -117,33 +122,80 @@ guardPredicate genPredicate(const set<vector<float>>& p,
                     pred.coeff.push_back((min_n + max_p)/2);
                 }
                 found = true;
+                profiler.count(trainingProfiler::BIVARIATE_HITS);
                 break;
             }
             if (found) break;
         }
+    }
 
 #endif
 
+    // Another heuristic: the hyperplanes of the candidate predicates, in either direction,
+    // with the offset in the middle of the groups.
+    for (int k = 0; !found && k < candidate_predicates.size(); k++)
+    {
+        const predicate& c = candidate_predicates[k];
+        auto value = [&](int id)
+            {
+                const float* x = s.at(id);
+                float v = 0.0;
+                for (int i = 0; i < num_vars; i++) v += c.coeff[i]*x[i];
+                return v;
+            };
+        float min_p = value(p.ids[0]), max_p = min_p;
+        for (int id : p.ids)
+        {
+            float v = value(id);
+            min_p = std::min(min_p, v);
+            max_p = std::max(max_p, v);
+        }
+        float min_n = value(n.ids[0]), max_n = min_n;
+        for (int id : n.ids)
+        {
+            float v = value(id);
+            min_n = std::min(min_n, v);
+            max_n = std::max(max_n, v);
+        }
+        if (max_p >= min_n && max_n >= min_p) continue;
+
+        pred.coeff.assign(c.coeff.begin(), c.coeff.begin() + num_vars);
+        if (min_p >= max_n)
+        {
+            pred.coeff.push_back(-(min_p + max_n)/2);
+        }
+        else
+        {
+            for (int i = 0; i < num_vars; i++) pred.coeff[i] = -pred.coeff[i];
+            pred.coeff.push_back((min_n + max_p)/2);
+        }
+        found = true;
+        profiler.count(trainingProfiler::CANDIDATE_HITS);
+    }
+
     if (!found)
-        pred = genPredicateUsingAlgLib(p, n, num_vars);
+    {
+        pred = genPredicateUsingAlgLib(s, p, n, num_vars);
+        if (!pred.coeff.empty()) profiler.count(trainingProfiler::LP_HITS);
+    }
 
     if (pred.coeff.empty()) return guardPredicate();
 
     // Check predicate.
 #ifdef CHECK
-    for (auto & x : p)
+    for (int x : p.ids)
     {
-        if (pred.evaluate(x) == false)
+        if (pred.evaluate(s.at(x), num_vars) == false)
         {
-            genPredicateError(x, p, n, pred);
+            genPredicateError(s, x, p, n, pred);
             return guardPredicate();
         }
     }
-    for (auto & x : n)
+    for (int x : n.ids)
     {
-        if (pred.evaluate(x) == true)
+        if (pred.evaluate(s.at(x), num_vars) == true)
         {
-            genPredicateError(x, p, n, pred);
+            genPredicateError(s, x, p, n, pred);
             return guardPredicate();
         }
     }
@@ -156,14 +208,15 @@ guardPredicate genPredicate(const set<vector<float>>& p,
     return g;
 }
 
-guardPredicate genPredicate(const vector<set<vector<float>>>& pos_groups,
-                            const set<vector<float>>& n, int num_vars)
+guardPredicate genPredicate(const pointStore& s,
+                            const vector<pointGroup>& pos_groups,
+                            const pointGroup& n, int num_vars)
 {
     guardPredicate g;
     guardPredicate::orPredicate o;
     for (auto& p : pos_groups)
     {
-        guardPredicate g_p = genPredicate(p, n, num_vars);
+        guardPredicate g_p = genPredicate(s, p, n, num_vars);
         if (g_p.clauses.empty()) return guardPredicate();
         o.terms.push_back(g_p.clauses[0].terms[0]);
     }
@@ -171,40 +224,158 @@ guardPredicate genPredicate(const vector<set<vector<float>>>& pos_groups,
     return g;
 }
 
-guardPredicate genPredicate(const vector<set<vector<float>>>& pos_groups,
-                            const vector<set<vector<float>>>& neg_groups,
+guardPredicate genPredicate(const pointStore& s,
+                            const vector<pointGroup>& pos_groups,
+                            const vector<pointGroup>& neg_groups,
                             int num_vars)
 {
     guardPredicate g;
     for (auto& n: neg_groups)
     {
-        guardPredicate g_n = genPredicate(pos_groups, n, num_vars);
+        guardPredicate g_n = genPredicate(s, pos_groups, n, num_vars);
         if (g_n.clauses.empty()) return guardPredicate();
         g.clauses.push_back(g_n.clauses[0]);
     }
     return g;
 }
 
-void split_group(const set<vector<float>>& g, const vector<float>& ce, vector<set<vector<float>>>& groups,
-                 vector<set<vector<float>>>& new_groups)
+vector<vector<float>> principalDirections(const pointStore& s, const pointGroup& g, int num_components)
+{
+    // Principal directions of the points in g, computed by power iteration on the
+    // covariance matrix (with deflation for subsequent components).
+    int n = s.num_vars;
+    vector<vector<float>> directions;
+    if (g.size() < 2) return directions;
+
+    vector<double> mean(n, 0.0);
+    for (int id : g.ids)
+    {
+        const float* x = s.at(id);
+        for (int i = 0; i < n; i++) mean[i] += x[i]/g.size();
+    }
+    vector<double> cov(n*n, 0.0);
+    for (int id : g.ids)
+    {
+        const float* x = s.at(id);
+        for (int i = 0; i < n; i++)
+            for (int j = 0; j < n; j++)
+                cov[i*n + j] += (x[i] - mean[i])*(x[j] - mean[j]);
+    }
+
+    for (int c = 0; c < num_components && c < n; c++)
+    {
+        vector<double> v(n, 1.0), w(n);
+        double norm = 0.0;
+        for (int iter = 0; iter < 50; iter++)
+        {
+            norm = 0.0;
+            for (int i = 0; i < n; i++)
+            {
+                w[i] = 0.0;
+                for (int j = 0; j < n; j++) w[i] += cov[i*n + j]*v[j];
+                norm += w[i]*w[i];
+            }
+            norm = std::sqrt(norm);
+            if (norm == 0.0) break;
+            for (int i = 0; i < n; i++) v[i] = w[i]/norm;
+        }
+        if (norm == 0.0) break;
+        directions.push_back(vector<float>(v.begin(), v.end()));
+        // Deflate: cov = cov - norm * v * v^T.
+        for (int i = 0; i < n; i++)
+            for (int j = 0; j < n; j++)
+                cov[i*n + j] -= norm*v[i]*v[j];
+    }
+    return directions;
+}
+
+bool sweepSplit(const pointStore& s, const pointGroup& g, int ce, const vector<float>& w,
+                pointGroup& g_less, pointGroup& g_more)
+{
+    // Sorts the points in g along direction w, and searches for a cut of the sorted
+    // points into a prefix g_less and a suffix g_more, so that both can be separated
+    // from ce. Separability of the prefix only decreases as the cut moves right, while
+    // separability of the suffix only increases, hence the largest feasible prefix is
+    // found by binary search, and it is the only cut that needs to be checked for the
+    // suffix.
+    int num_vars = s.num_vars;
+    pointGroup ce_group(s, ce);
+    auto project = [&](const float* x)
+        {
+            float val = 0.0;
+            for (int i = 0; i < num_vars; i++) val += w[i]*x[i];
+            return val;
+        };
+
+    vector<pair<float, int>> sorted;
+    for (int id : g.ids)
+        sorted.emplace_back(project(s.at(id)), id);
+    std::sort(sorted.begin(), sorted.end());
+    vector<int> ids;
+    for (auto& p : sorted) ids.push_back(p.second);
+
+    auto prefix_feasible = [&](int k)
+        {
+            pointGroup prefix(s, ids.begin(), ids.begin() + k);
+            return !genPredicate(s, prefix, ce_group, num_vars).clauses.empty();
+        };
+    auto suffix_feasible = [&](int k)
+        {
+            pointGroup suffix(s, ids.begin() + k, ids.end());
+            return !genPredicate(s, suffix, ce_group, num_vars).clauses.empty();
+        };
+
+    // Try the cut at the projection of ce first, which is feasible unless points project
+    // to the same value as ce.
+    float ce_val = project(s.at(ce));
+    int k0 = std::lower_bound(sorted.begin(), sorted.end(), make_pair(ce_val, -1)) - sorted.begin();
+    bool tie = k0 < sorted.size() && sorted[k0].first == ce_val;
+    if (!tie && k0 > 0 && k0 < ids.size() && prefix_feasible(k0) && suffix_feasible(k0))
+    {
+        g_less = pointGroup(s, ids.begin(), ids.begin() + k0);
+        g_more = pointGroup(s, ids.begin() + k0, ids.end());
+        return true;
+    }
+
+    int lo = 1, hi = ids.size() - 1;
+    if (hi < lo || !prefix_feasible(lo)) return false;
+    while (lo < hi)
+    {
+        int mid = (lo + hi + 1)/2;
+        if (prefix_feasible(mid)) lo = mid;
+        else hi = mid - 1;
+    }
+    if (!suffix_feasible(lo)) return false;
+    g_less = pointGroup(s, ids.begin(), ids.begin() + lo);
+    g_more = pointGroup(s, ids.begin() + lo, ids.end());
+    return true;
+}
+
+void split_group(const pointStore& s, const pointGroup& g, int ce, vector<pointGroup>& new_groups)
 {
     // Splits group g into two groups, such that the counterexample ce can be accomodated.
-    // Updates groups with the new groups while erasing old group g.
+    // Appends the new groups to new_groups.
+    profiler.count(trainingProfiler::SPLITS);
+    auto start = std::chrono::steady_clock::now();
 
-    set<vector<float>> g_less, g_more;
+    pointGroup g_less, g_more;
+    pointGroup ce_group(s, ce);
+    const float* x_ce = s.at(ce);
+    int num_vars = s.num_vars;
     bool found = false;
 
     // Manual heuristics to split the set.
     // Split by axis.
-    for (int i = 0; i < ce.size(); i++)
+    for (int i = 0; i < num_vars; i++)
     {
-        g_less.clear();
-        g_more.clear();
+        g_less = pointGroup();
+        g_more = pointGroup();
         bool infeasible = false;
-        for (auto &p : g)
+        for (int id : g.ids)
         {
-            if (p[i] < ce[i]) g_less.emplace(p);
-            else if (p[i] > ce[i]) g_more.emplace(p);
+            const float* p = s.at(id);
+            if (p[i] < x_ce[i]) g_less.insert(s, id);
+            else if (p[i] > x_ce[i]) g_more.insert(s, id);
             else
             {
                 infeasible = true;
@@ -219,16 +390,18 @@ void split_group(const set<vector<float>>& g, const vector<float>& ce, vector<se
     }
 #ifdef NORMALIZE
     if (!found)
-        for (int i = 0; i < ce.size(); i++)
+        for (int i = 0; i < num_vars; i++)
         {
-            for (int j = i + 1; j < ce.size(); j++)
+            for (int j = i + 1; j < num_vars; j++)
             {
-                g_less.clear(); g_more.clear();
+                g_less = pointGroup();
+                g_more = pointGroup();
                 bool infeasible = false;
-                for (auto & x : g)
+                for (int id : g.ids)
                 {
-                    if (x[i] + x[j] < ce[i] + ce[j]) g_less.emplace(x);
-                    else if (x[i] + x[j] > ce[i] + ce[j]) g_more.emplace(x);
+                    const float* x = s.at(id);
+                    if (x[i] + x[j] < x_ce[i] + x_ce[j]) g_less.insert(s, id);
+                    else if (x[i] + x[j] > x_ce[i] + x_ce[j]) g_more.insert(s, id);
                     else
                     {
                         infeasible = true;
@@ -244,18 +417,30 @@ void split_group(const set<vector<float>>& g, const vector<float>& ce, vector<se
         }
 #endif
 
-    // Try global splitting heuristic.
+    // Try global splitting heuristic: sweep the points along candidate directions, i.e.
+    // the direction from ce to the centroid of g (along which g could not be separated
+    // from ce), the principal directions of g and the axes.
     if (!found)
     {
-        g_less.clear();
-        g_more = g;
-        for (int i = 0; i < g.size() - 1; i++)
+        vector<vector<float>> directions;
+        vector<float> centroid_dir(num_vars, 0.0);
+        for (int id : g.ids)
         {
-            auto p = *g_more.begin();
-            g_less.insert(p);
-            g_more.erase(g_more.begin());
-            if (!genPredicate(g_less, {ce}, ce.size()).clauses.empty() &&
-                !genPredicate(g_more, {ce}, ce.size()).clauses.empty())
+            const float* p = s.at(id);
+            for (int i = 0; i < num_vars; i++) centroid_dir[i] += (p[i] - x_ce[i])/g.size();
+        }
+        directions.push_back(centroid_dir);
+        for (auto& d : principalDirections(s, g, 2))
+            directions.push_back(d);
+        for (int i = 0; i < num_vars; i++)
+        {
+            vector<float> axis(num_vars, 0.0);
+            axis[i] = 1.0;
+            directions.push_back(axis);
+        }
+        for (auto& d : directions)
+        {
+            if (sweepSplit(s, g, ce, d, g_less, g_more))
             {
                 found = true;
                 break;
@@ -265,120 +450,258 @@ void split_group(const set<vector<float>>& g, const vector<float>& ce, vector<se
 
     if (!found)
     {
-        for (int i = 0; i < NUM_ITERATIONS; i++)
-        {
-            // Find an affine function f, so that f(ce) = 0, f(p) != 0 for all p in g.
-            affineFunction f = findAffineFunctionPassingThroughCEOnlyAlternate(g, ce);
-    
-            g_less.clear();
-            g_more.clear();
-            for (auto p: g)
-            {
-                if (f.evaluate(p) > 0)
-                    g_more.emplace(p);
-                else
-                    g_less.emplace(p);
-            }
-            if (g_more.size() > 0 && g_less.size() > 0 &&
-                !genPredicate(g_less, {ce}, ce.size()).clauses.empty() &&
-                !genPredicate(g_more, {ce}, ce.size()).clauses.empty())
+        // Randomized splits. The trials are independent (each draws from its own random
+        // stream), so they are run concurrently and the first successful trial is used.
+        // The pairwise bounds of the shared groups are computed up front, so that the trials
+        // only read them.
+        ce_group.sums(s);
+        g.sums(s);
+        vector<pair<pointGroup, pointGroup>> trial_splits(NUM_ITERATIONS);
+        int trial = parallelFindFirst(NUM_ITERATIONS, [&](int i)
             {
-                found = true;
-                break;
-            }
+                // Find an affine function f, so that f(ce) = 0, f(p) != 0 for all p in g.
+                affineFunction f = findAffineFunctionPassingThroughCEOnlyAlternate(s, g, ce, i);
+                if (f.coeff.empty()) return false;
+
+                pointGroup t_less, t_more;
+                for (int id : g.ids)
+                {
+                    if (f.evaluate(s.at(id), num_vars) > 0)
+                        t_more.insert(s, id);
+                    else
+                        t_less.insert(s, id);
+                }
+                if (t_more.size() > 0 && t_less.size() > 0 &&
+                    !genPredicate(s, t_less, ce_group, num_vars).clauses.empty() &&
+                    !genPredicate(s, t_more, ce_group, num_vars).clauses.empty())
+                {
+                    trial_splits[i] = make_pair(t_less, t_more);
+                    return true;
+                }
+                return false;
+            });
+        if (trial < NUM_ITERATIONS)
+        {
+            g_less = trial_splits[trial].first;
+            g_more = trial_splits[trial].second;
+            found = true;
         }
     }
 
 #ifdef DEBUG
     std::cerr << "Split Group Result: " << std::endl;
-    for (auto &p : g_less)
+    for (int id : g_less.ids)
     {
-        std::cerr << vectorString(p) << ", ";
+        std::cerr << vectorString(s.point(id)) << ", ";
     }
     std::cerr << std::endl;
-    for (auto &p : g_more)
+    for (int id : g_more.ids)
     {
-        std::cerr << vectorString(p) << ", ";
+        std::cerr << vectorString(s.point(id)) << ", ";
     }
 #endif
-    // auto it = std::find(groups.begin(), groups.end(), g);
-    // if (it != groups.end())
-    //    groups.erase(it);
-
     if (found)
     {
         new_groups.push_back(g_more);
         new_groups.push_back(g_less);
     }
+    if (capture.enabled())
+    {
+        vector<float> sizes;
+        if (found) sizes = {(float)g_less.size(), (float)g_more.size()};
+        capture.record(solverCapture::SPLIT, s, g.ids, vector<int>(1, ce), vector<float>(), sizes,
+                       elapsedMicroseconds(start));
+    }
+}
+
+bool boxSeparated(const pointGroup::bounds& a, const pointGroup::bounds& b)
+{
+    // True if the bounding boxes are disjoint along some axis, in which case the groups
+    // are separable by an axis predicate.
+    for (int i = 0; i < a.min_val.size(); i++)
+    {
+        if (a.max_val[i] < b.min_val[i] || b.max_val[i] < a.min_val[i])
+            return true;
+    }
+    return false;
+}
+
+float boxDistance(const pointGroup::bounds& a, const pointGroup::bounds& b)
+{
+    float dist = 0.0;
+    for (int i = 0; i < a.min_val.size(); i++)
+    {
+        float gap = std::max(a.min_val[i] - b.max_val[i], b.min_val[i] - a.max_val[i]);
+        if (gap > 0) dist += gap*gap;
+    }
+    return dist;
 }
 
-guardPredicate simplify(const vector<set<vector<float>>>& pos_groups,
-                        const vector<set<vector<float>>>& neg_groups,
+int findMerge(const pointStore& s, const pointGroup& g,
+              const vector<pointGroup>& simplified_groups,
+              const vector<pointGroup>& opposite_groups,
+              int num_vars)
+{
+    // Returns the first simplified group that g can be merged with, i.e. the merged group
+    // can still be separated from all the opposite groups, or -1 if there is none.
+    // A merge is feasible without solving for predicates if the bounding box of the merged
+    // group is disjoint from the bounding boxes of all opposite groups. The groups before
+    // the first such merge are checked in parallel (at most simplify_candidates of them,
+    // nearest to g, if set).
+    vector<int> candidates;
+    int separated_merge = -1;
+    for (int j = 0; j < simplified_groups.size(); j++)
+    {
+        pointGroup::bounds merged_box;
+        merged_box.min_val = g.b.min_val;
+        merged_box.max_val = g.b.max_val;
+        auto& other = simplified_groups[j].b;
+        for (int i = 0; i < num_vars; i++)
+        {
+            merged_box.min_val[i] = std::min(merged_box.min_val[i], other.min_val[i]);
+            merged_box.max_val[i] = std::max(merged_box.max_val[i], other.max_val[i]);
+        }
+        bool separated = true;
+        for (auto& n : opposite_groups)
+        {
+            if (!boxSeparated(merged_box, n.b))
+            {
+                separated = false;
+                break;
+            }
+        }
+        if (separated)
+        {
+            separated_merge = j;
+            break;
+        }
+        candidates.push_back(j);
+    }
+
+    if (simplify_candidates > 0 && candidates.size() > simplify_candidates)
+    {
+        std::stable_sort(candidates.begin(), candidates.end(), [&](int a, int b)
+            {
+                return boxDistance(g.b, simplified_groups[a].b) < boxDistance(g.b, simplified_groups[b].b);
+            });
+        candidates.resize(simplify_candidates);
+        std::sort(candidates.begin(), candidates.end());
+    }
+
+    int k = parallelFindFirst(candidates.size(), [&](int c)
+        {
+            auto merged_group = g;
+            merged_group.merge(simplified_groups[candidates[c]]);
+            return !genPredicate(s, opposite_groups, merged_group, num_vars).clauses.empty();
+        });
+    return k < candidates.size() ? candidates[k] : separated_merge;
+}
+
+guardPredicate simplify(const pointStore& s,
+                        const vector<pointGroup>& pos_groups,
+                        const vector<pointGroup>& neg_groups,
                         int num_vars)
 {
+    // The pairwise bounds of the groups are computed up front, since the groups are
+    // shared by the parallel merge checks.
+    for (auto& p : pos_groups) p.sums(s);
+    for (auto& n : neg_groups) n.sums(s);
+
     // Try merging pos_groups, if extraneous groups are formed.
-    vector<set<vector<float>>> simplified_pos_groups, simplified_neg_groups;
+    vector<pointGroup> simplified_pos_groups, simplified_neg_groups;
     simplified_pos_groups.push_back(pos_groups[0]);
     for (int i = 1; i < pos_groups.size(); i++)
     {
-        bool merged = false;
         // Check if pos_group[i] can be merged with any of the simplified groups.
-        for (int j = 0; j < simplified_pos_groups.size(); j++)
-        {
-            auto merged_group = pos_groups[i];
-            for (auto & x : simplified_pos_groups[j])
-                merged_group.emplace(x);
-            if (genPredicate(neg_groups, merged_group, num_vars).clauses.empty())
-                continue;
-            // Merging is feasible.
-            merged = true;
-            for (auto & x: pos_groups[i])
-                simplified_pos_groups[j].emplace(x);
-            break;
+        int j = findMerge(s, pos_groups[i], simplified_pos_groups, neg_groups, num_vars);
+        if (j >= 0)
+        {
+            simplified_pos_groups[j].merge(pos_groups[i]);
+            profiler.count(trainingProfiler::SIMPLIFY_MERGES);
         }
-        if (!merged)
+        else
             simplified_pos_groups.push_back(pos_groups[i]);
     }
     simplified_neg_groups.push_back(neg_groups[0]);
     for (int i = 1; i < neg_groups.size(); i++)
     {
-        bool merged = false;
         // Check if neg_group[i] can be merged with any of the simplified groups.
-        for (int j = 0; j < simplified_neg_groups.size(); j++)
-        {
-            auto merged_group = neg_groups[i];
-            for (auto & x : simplified_neg_groups[j])
-                merged_group.emplace(x);
-            if (genPredicate(pos_groups, merged_group, num_vars).clauses.empty())
-                continue;
-            // Merging is feasible.
+        int j = findMerge(s, neg_groups[i], simplified_neg_groups, pos_groups, num_vars);
+        if (j >= 0)
+        {
+            simplified_neg_groups[j].merge(neg_groups[i]);
+            profiler.count(trainingProfiler::SIMPLIFY_MERGES);
+        }
+        else
+            simplified_neg_groups.push_back(neg_groups[i]);
+    }
+    return genPredicate(s, simplified_pos_groups, simplified_neg_groups, num_vars);
+}
+
+void processCounterexample(const pointStore& s, int ce, bool positive,
+                           vector<pointGroup>& pos_groups,
+                           vector<pointGroup>& neg_groups,
+                           int num_vars, int& iter_count)
+{
+    // A positive counterexample is split away from the conflicting negative groups and
+    // then added to a compatible positive group (and vice-versa for a negative one).
+    vector<pointGroup>& same_groups = positive ? pos_groups : neg_groups;
+    vector<pointGroup>& other_groups = positive ? neg_groups : pos_groups;
+    pointGroup ce_group(s, ce);
+
+    vector<pointGroup> new_groups;
+    for (auto& n : other_groups)
+    {
+        if (genPredicate(s, ce_group, n, num_vars).clauses.empty())
+        {
+            // ce conflicts with n.
+            // n needs to be split.
+#ifdef DEBUG
+            std::cerr << "Split Groups call: " << iter_count << std::endl;
+#endif
+            split_group(s, n, ce, new_groups);
+            iter_count++;
+        }
+        else
+            new_groups.push_back(n);
+    }
+    other_groups = new_groups;
+    bool merged = false;
+    for (auto& p : same_groups)
+    {
+        auto saved_bounds = p.b;
+        p.insert(s, ce);
+        if (genPredicate(s, other_groups, p, num_vars).clauses.empty() == false)
+        {
             merged = true;
-            for (auto & x: neg_groups[i])
-                simplified_neg_groups[j].emplace(x);
             break;
         }
-        if (!merged)
-            simplified_neg_groups.push_back(neg_groups[i]);
+        else
+        {
+            p.ids.pop_back();
+            p.b = saved_bounds;
+        }
+    }
+
+    if (!merged)
+    {
+        same_groups.push_back(ce_group);
     }
-    return genPredicate(simplified_pos_groups, simplified_neg_groups, num_vars);
 }
 
-guardPredicate genGuard(set<vector<float>>& pos_points,
-                        set<vector<float>>& neg_points,
-                        int num_vars)
+guardPredicate genGuard(const pointStore& s, int first_pos, int first_neg,
+                        const counterexampleFinder& findCounterexamples,
+                        int num_vars, timePoint deadline)
 {
     // We collect groups of positive and negative points.
     // Each group forms a cluster that is separated simultaneously
     // from other clusters. By grouping points, we are able to
     // learn a single separator for all points in the group, thereby
     // improving the model learnt.
-    vector<set<vector<float>>> pos_groups, neg_groups;
-
-    if (pos_points.size() == 0) return false_predicate(num_vars);
-    if (neg_points.size() == 0) return true_predicate(num_vars);
+    vector<pointGroup> pos_groups, neg_groups;
 
-    pos_groups.push_back({*pos_points.begin()});
-    neg_groups.push_back({*neg_points.begin()});
+    pos_groups.push_back(pointGroup(s, first_pos));
+    neg_groups.push_back(pointGroup(s, first_neg));
 
     int iter_count = 0;
     while (iter_count <= num_splits)
@@ -386,147 +709,158 @@ guardPredicate genGuard(set<vector<float>>& pos_points,
 #ifdef DEBUG
         // std::cerr << "Iteration " << iter_count++ << std::endl;
 #endif
-        guardPredicate g = genPredicate(pos_groups, neg_groups, num_vars);
-        vector<vector<float>> counterexamples; 
-        for (auto& p : pos_points)
-        {
-            if (g.evaluate(p) == false)
-            {
-                counterexamples.emplace_back(p);
-            }
-        }
-        for (auto& p : neg_points)
+        profiler.count(trainingProfiler::CEGIS_ITERATIONS);
+        guardPredicate g = genPredicate(s, pos_groups, neg_groups, num_vars);
+        vector<pair<int, bool>> counterexamples;
+        findCounterexamples(g, counterexamples);
+        
+        if (std::chrono::steady_clock::now() >= deadline)
         {
-            if (g.evaluate(p) == true)
-                counterexamples.emplace_back(p);
+            // Out of time: the guard is returned as is (simplify could take as long as the
+            // iterations it saves).
+            std::cerr << "Time budget reached with " << counterexamples.size()
+                      << " counterexamples for the guard." << std::endl;
+            return g;
         }
-        
         if (counterexamples.empty() || iter_count == num_splits)
         {
 #ifdef SIMPLIFY
-            g = simplify(pos_groups, neg_groups, num_vars);
+            g = simplify(s, pos_groups, neg_groups, num_vars);
 #endif
             return g;
         }
 
-        auto ce = *counterexamples.begin();
-        if (g.evaluate(ce) == false)
+        if (ce_batch_size == 1)
         {
-            // Process positive counterexample.
-            vector<set<vector<float>>> new_groups;
-            for (auto& n : neg_groups)
-            {
-                if (genPredicate({ce}, n, num_vars).clauses.empty())
-                {
-                    // ce conflicts with n.
-                    // n needs to be split.
-#ifdef DEBUG
-                    std::cerr << "Split Groups call: " << iter_count << std::endl;
-#endif
-                    split_group(n, ce, neg_groups, new_groups);
-                    iter_count++;
-                }
-                else
-                    new_groups.push_back(n);
-            }
-            neg_groups = new_groups;
-            bool merged = false;
-            for (auto& p : pos_groups)
-            {
-                p.insert(ce);
-                if (genPredicate(neg_groups, p, num_vars).clauses.empty() == false)
-                {
-                    merged = true;
-                    break;
-                }
-                else
-                {
-                    p.erase(p.find(ce));
-                }
-            }
+            auto& ce = *counterexamples.begin();
+            processCounterexample(s, ce.first, ce.second, pos_groups, neg_groups, num_vars, iter_count);
+            continue;
+        }
 
-            if (!merged)
-            {
-                pos_groups.push_back({ce});
-            }
+        // Process a batch of counterexamples against the current groups, before the guard is
+        // regenerated. Counterexamples already in a group (possible if the guard could not be
+        // generated) are skipped.
+        vector<char> grouped(s.size(), false);
+        for (auto& p : pos_groups)
+            for (int id : p.ids) grouped[id] = true;
+        for (auto& n : neg_groups)
+            for (int id : n.ids) grouped[id] = true;
+        int processed = 0;
+        for (auto& ce : counterexamples)
+        {
+            if (ce_batch_size > 0 && processed == ce_batch_size) break;
+            if (iter_count >= num_splits) break;
+            if (std::chrono::steady_clock::now() >= deadline) break;
+            if (grouped[ce.first]) continue;
+            processCounterexample(s, ce.first, ce.second, pos_groups, neg_groups, num_vars, iter_count);
+            processed++;
         }
-        else
+        if (processed == 0)
         {
-            // Process negative counterexample.
-            vector<set<vector<float>>> new_groups;
-            for (auto& p : pos_groups)
-            {
-                if (genPredicate({ce}, p, num_vars).clauses.empty())
-                {
-#ifdef DEBUG
-                    std::cerr << "Split Groups call: " << iter_count << std::endl;
+#ifdef SIMPLIFY
+            g = simplify(s, pos_groups, neg_groups, num_vars);
 #endif
-                    // ce conflicts with p.
-                    // p needs to be split.
-                    split_group(p, ce, pos_groups, new_groups);
-                    iter_count++;
-                }
-                else
-                    new_groups.push_back(p);
-            }
-            pos_groups = new_groups;
-            bool merged = false;
-            for (auto& n : neg_groups)
+            return g;
+        }
+    }
+    return guardPredicate();
+}
+
+guardPredicate genGuard(const pointStore& s,
+                        const vector<int>& pos_points,
+                        const vector<int>& neg_points,
+                        int num_vars, timePoint deadline)
+{
+    if (pos_points.size() == 0) return false_predicate(num_vars);
+    if (neg_points.size() == 0) return true_predicate(num_vars);
+
+    auto findCounterexamples = [&](const guardPredicate& g, vector<pair<int, bool>>& counterexamples)
+        {
+            for (int id : pos_points)
             {
-                n.insert(ce);
-                if (genPredicate(pos_groups, n, num_vars).clauses.empty() == false)
-                {
-                    merged = true;
-                    break;
-                }
-                else
-                {
-                    n.erase(n.find(ce));
-                }
+                if (g.evaluate(s.at(id), num_vars) == false)
+                    counterexamples.emplace_back(id, true);
             }
-            if (!merged)
+            for (int id : neg_points)
             {
-                neg_groups.push_back({ce});
+                if (g.evaluate(s.at(id), num_vars) == true)
+                    counterexamples.emplace_back(id, false);
             }
+        };
+    return genGuard(s, pos_points[0], neg_points[0], findCounterexamples, num_vars, deadline);
+}
+
+int labelPoint(const vector<affineFunction>& affineFunctions, const vector<char>& has_region, int j,
+               const float* x, float y, float threshold, int num_vars)
+{
+    bool pos_label = false, neg_label = false;
+    bool already_labeled = false;
+    for (int k = 0; k < affineFunctions.size(); k++)
+    {
+        if (has_region[k] &&
+            abs(affineFunctions[k].evaluate(x, num_vars) - y) < threshold)
+        {
+            already_labeled = true;
+            break;
         }
     }
-    return guardPredicate();
+    if (already_labeled) return 0;
+
+    if (abs(affineFunctions[j].evaluate(x, num_vars) - y) < threshold)
+    {
+        pos_label = true;
+    }
+    for (int k = 0; k < affineFunctions.size(); k++)
+    {
+        if (has_region[k] || k == j) continue;
+        if (abs(affineFunctions[k].evaluate(x, num_vars) - y) < threshold)
+        {
+            neg_label = true;
+            break;
+        }
+    }
+    if (pos_label && !neg_label) return 1;
+    if (neg_label && !pos_label) return -1;
+    return 0;
+}
+
+// Weight of a point (1 if the points are not weighted).
+static inline double pointWeight(const vector<float>& weights, int id)
+{
+    return weights.empty() ? 1.0 : weights[id];
 }
 
-affineFunction genAffineFunction(const map<vector<float>, float>& data, set<vector<float>>& covered,
-                                 float threshold, int num_vars)
+affineFunction genAffineFunction(const pointStore& data, const vector<float>& outputs,
+                                 const vector<char>& covered, float threshold, int num_vars,
+                                 const vector<float>& weights = vector<float>())
 {
     // Find a point that is not covered.
     // Seed point.
-    vector<float> x_p;
-    float y_p;
-    for (auto p : data)
-    {
-        if (covered.find(p.first) != covered.end()) continue;
-        x_p = p.first;
-        y_p = p.second;
-        break;
-    }
+    int seed = 0;
+    while (seed < data.size() && covered[seed]) seed++;
+    if (seed == data.size()) return affineFunction();
+    const float* x_p = data.at(seed);
 
     // Find atleast N + 1 points around the seed point to learn a model.
-    set<vector<float>> seed_points;
-    seed_points.emplace(x_p);
+    vector<int> seed_points;
+    seed_points.push_back(seed);
     for (int i = 0; i < num_vars + 1; i++)
     {
         // Find next point.
-        vector<float> min_point = x_p;
+        int min_point = -1;
         float min_dist = 0.0;
-        for (auto& p : data)
+        for (int id = 0; id < data.size(); id++)
         {
-            if (seed_points.find(p.first) != seed_points.end()) continue;
-            if (covered.find(p.first) != covered.end()) continue;
-            float dist = distance(x_p, p.first);
-            if (min_point == x_p || min_dist > dist)
+            if (covered[id]) continue;
+            if (std::find(seed_points.begin(), seed_points.end(), id) != seed_points.end()) continue;
+            float dist = distance(x_p, data.at(id), num_vars);
+            if (min_point == -1 || min_dist > dist)
             {
-                min_point = p.first; min_dist = dist;
+                min_point = id; min_dist = dist;
             }
         }
-        seed_points.emplace(min_point);
+        if (min_point != -1)
+            seed_points.push_back(min_point);
     }
 
 #ifdef CHECK
@@ -535,41 +869,36 @@ affineFunction genAffineFunction(const map<vector<float>, float>& data, set<vect
         return affineFunction();
 #endif
 
-    set<vector<float>> points;
-    vector<float> new_point;
-    for (auto& p : seed_points)
-    {
-        new_point = p;
-        new_point.emplace_back(data.at(p));
-        points.emplace(new_point);
-    }
-    affineFunction l = trainModelUsingAlgLib(points, num_vars);
+    vector<int> points = seed_points;
+    affineFunction l = trainModelUsingAlgLib(data, outputs, points, num_vars, weights);
+    double points_weight = 0.0;
+    for (int id : points) points_weight += pointWeight(weights, id);
 
     while (true)
     {
-        set<vector<float>> l_covered;
-        for (auto p : data)
+        vector<int> l_covered;
+        double l_covered_weight = 0.0;
+        for (int id = 0; id < data.size(); id++)
         {
-            if (covered.find(p.first) != covered.end()) continue;
-            if (abs(l.evaluate(p.first) - p.second) < threshold)
-                l_covered.emplace(p.first);
+            if (covered[id]) continue;
+            if (abs(l.evaluate(data.at(id), num_vars) - outputs[id]) < threshold)
+            {
+                l_covered.push_back(id);
+                l_covered_weight += pointWeight(weights, id);
+            }
         }
-        if (points.size() >= l_covered.size())
+        if (points_weight >= l_covered_weight)
            break;
-        points.clear();
-        for (auto& p : l_covered)
-        {
-            vector<float> new_point = p;
-            new_point.push_back(data.at(p));
-            points.emplace(new_point);
-        }
-        l = trainModelUsingAlgLib(points, num_vars);
+        points.swap(l_covered);
+        points_weight = l_covered_weight;
+        l = trainModelUsingAlgLib(data, outputs, points, num_vars, weights);
     }
     return l;
 }
 
 std::vector<float> normalizeInput(const map<vector<float>, float>& data,
-                                  map<vector<float>, float>& normalized_data,
+                                  pointStore& normalized_data,
+                                  vector<float>& outputs,
                                   int num_vars)
 {
     std::vector<float> scale_vec;
@@ -591,68 +920,287 @@ std::vector<float> normalizeInput(const map<vector<float>, float>& data,
         scale_vec[i] = feature_avg;
     }
 #endif
+    // The normalized points are stored in a single flat array.
+    normalized_data = pointStore(num_vars);
+    normalized_data.values.reserve(data.size()*num_vars);
+    outputs.reserve(data.size());
     for (auto &p : data)
     {
-        std::vector<float> normalized;
         for (int i = 0; i < num_vars; i++)
-            normalized.push_back(p.first[i]/scale_vec[i]);
+            normalized_data.values.push_back(p.first[i]/scale_vec[i]);
+        outputs.push_back(p.second);
+    }
+    return scale_vec;
+}
 
-        normalized_data.emplace(normalized, p.second);
+std::vector<float> normalizeInput(const dataSet& data, pointStore& normalized_data, vector<float>& outputs,
+                                  const vector<float>& scale)
+{
+    int num_vars = data.num_vars;
+    std::vector<float> scale_vec(num_vars, 1.0);
+    if (data.size() == 0) return scale_vec;
+
+    if (!scale.empty())
+    {
+        scale_vec = scale;
     }
+#ifdef NORMALIZE
+    else
+    {
+        for (int i = 0; i < num_vars; i++)
+        {
+            // Normalize ith feature.
+            float feature_avg = 0.0;
+            for (long long r = 0; r < data.size(); r++)
+            {
+                feature_avg += data.at(r)[i]/data.size();
+            }
+            scale_vec[i] = feature_avg;
+        }
+    }
+#endif
+    normalized_data = pointStore(num_vars);
+    normalized_data.values.resize(data.inputs.size());
+    for (size_t k = 0; k < data.inputs.size(); k++)
+        normalized_data.values[k] = data.inputs[k]/scale_vec[k % num_vars];
+    outputs = data.outputs;
     return scale_vec;
 }
 
 piecewiseAffineModel learnModelFromData(const map<vector<float>, float>& data, float threshold)
+{
+    return learnModelFromData(toDataSet(data), threshold);
+}
+
+piecewiseAffineModel learnModelFromData(const dataSet& data, float threshold, const vector<float>& scale)
 {
     piecewiseAffineModel model;
 
     if (data.size() == 0) return model;
 
-    int num_vars = data.begin()->first.size();
+    int num_vars = data.num_vars;
+    // Points stand for as many rows as their weight (unweighted if every weight is 1, which
+    // leaves the solvers as they are).
+    vector<float> weights;
+    for (float w : data.weights)
+    {
+        if (w != 1.0)
+        {
+            weights = data.weights;
+            break;
+        }
+    }
+
+    // Deadlines for the time budget.
+    auto start = std::chrono::steady_clock::now();
+    timePoint deadline = timePoint::max(), discovery_deadline = timePoint::max();
+    if (time_budget > 0)
+    {
+        auto budget = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(time_budget));
+        deadline = start + budget;
+        discovery_deadline = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            budget*DISCOVERY_BUDGET_SHARE);
+    }
 
     // Normalize input.
-    map<vector<float>, float> normalized_data;
-    auto scale_vec = normalizeInput(data, normalized_data, num_vars);
+    auto phase_start = std::chrono::steady_clock::now();
+    pointStore normalized_data;
+    vector<float> outputs;
+    auto scale_vec = normalizeInput(data, normalized_data, outputs, scale);
     model.scale_vec = scale_vec;
+    int num_points = normalized_data.size();
+    profiler.addPhase("normalize", elapsedSeconds(phase_start));
+    phase_start = std::chrono::steady_clock::now();
+
+    // Resume from the checkpoint, if it was taken on the same data.
+    trainingCheckpoint checkpoint;
+    checkpoint.num_points = num_points;
+    checkpoint.num_vars = num_vars;
+    checkpoint.threshold = threshold;
+    for (float y : outputs) checkpoint.output_sum += y;
+    if (resume_from_checkpoint && !checkpoint_path.empty())
+    {
+        trainingCheckpoint saved;
+        if (saved.read(checkpoint_path) && saved.matches(checkpoint))
+        {
+            checkpoint = saved;
+            std::cerr << "Resuming with " << checkpoint.functions.size() << " affine functions and "
+                      << checkpoint.region_functions.size() << " regions." << std::endl;
+        }
+        else
+        {
+            std::cerr << "No checkpoint for this data at " << checkpoint_path << ", starting over." << std::endl;
+        }
+    }
+    if (!checkpoint.discovery_complete)
+    {
+        // The order of the regions depends on the complete set of functions.
+        checkpoint.region_functions.clear();
+        checkpoint.region_guards.clear();
+    }
+    auto checkpoint_time = std::chrono::steady_clock::now();
+    auto saveCheckpoint = [&]()
+        {
+            if (checkpoint_path.empty()) return;
+            checkpoint.write(checkpoint_path);
+            checkpoint_time = std::chrono::steady_clock::now();
+        };
 
     // learn affine functions.
     vector<affineFunction> affineFunctions;
-    set<vector<float>> covered;
+    vector<char> covered(num_points, false);
+    int covered_count = 0;
+    auto cover = [&](const affineFunction& l)
+        {
+            for (int id = 0; id < num_points; id++)
+            {
+                if (!covered[id] && abs(l.evaluate(normalized_data.at(id), num_vars) - outputs[id]) < threshold)
+                {
+                    covered[id] = true;
+                    covered_count++;
+                }
+            }
+            affineFunctions.push_back(l);
+        };
+    for (auto& l : checkpoint.functions)
+        cover(l);
 
-    while (covered.size() < normalized_data.size())
+    // Warm start from the initial model (rescaled to the normalization of the data): its
+    // functions are kept greedily (most points covered first) while they cover enough points
+    // that are not covered yet, and the predicates of its guards are candidate predicates.
+    // The list is only cleared if needed, since the cells train concurrently without an
+    // initial model (see learnModelByCells).
+    if (!candidate_predicates.empty()) candidate_predicates.clear();
+    if (!initial_model.regions.empty() && initial_model.scale_vec.size() == num_vars)
     {
-        affineFunction l = genAffineFunction(normalized_data, covered, threshold, num_vars);
+        vector<affineFunction> initial_functions;
+        for (auto r : initial_model.regions)
+        {
+            rescaleCoefficients(r.f.coeff, initial_model.scale_vec, scale_vec);
+            if (std::find(initial_functions.begin(), initial_functions.end(), r.f) == initial_functions.end())
+                initial_functions.push_back(r.f);
+            for (auto& c : r.g.clauses)
+            {
+                for (auto t : c.terms)
+                {
+                    // Constant predicates (true and false) are of no use.
+                    bool constant = true;
+                    for (int i = 0; i < num_vars; i++)
+                        if (t.coeff[i] != 0.0) constant = false;
+                    if (constant) continue;
+                    rescaleCoefficients(t.coeff, initial_model.scale_vec, scale_vec);
+                    if (std::find(candidate_predicates.begin(), candidate_predicates.end(), t) == candidate_predicates.end())
+                        candidate_predicates.push_back(t);
+                }
+            }
+        }
+        int kept = 0, initial_count = initial_functions.size();
+        if (checkpoint.functions.empty())
+        {
+            int min_cover = std::max(num_vars + 2, (int)(INIT_MIN_COVER_SHARE*num_points));
+            while (!initial_functions.empty())
+            {
+                int best = -1;
+                double best_cover = 0;
+                for (int k = 0; k < initial_functions.size(); k++)
+                {
+                    double count = 0;
+                    for (int id = 0; id < num_points; id++)
+                    {
+                        if (!covered[id] &&
+                            abs(initial_functions[k].evaluate(normalized_data.at(id), num_vars) - outputs[id]) < threshold)
+                            count += pointWeight(weights, id);
+                    }
+                    if (count > best_cover)
+                    {
+                        best = k;
+                        best_cover = count;
+                    }
+                }
+                if (best == -1 || best_cover < min_cover) break;
+                cover(initial_functions[best]);
+                checkpoint.functions.push_back(initial_functions[best]);
+                initial_functions.erase(initial_functions.begin() + best);
+                kept++;
+            }
+        }
+        std::cerr << "Kept " << kept << " of " << initial_count << " functions of the initial model, with "
+                  << num_points - covered_count << " points left to cover." << std::endl;
+    }
+
+    while (!checkpoint.discovery_complete && covered_count < num_points)
+    {
+        if (std::chrono::steady_clock::now() >= discovery_deadline)
+        {
+            std::cerr << "Time budget for affine functions reached with " << num_points - covered_count
+                      << " points not covered." << std::endl;
+            break;
+        }
+        affineFunction l = genAffineFunction(normalized_data, outputs, covered, threshold, num_vars, weights);
 #ifdef DEBUG
         std::cerr << "Found an affine function: " << outputAffineFunction(l) << std::endl;
 #endif
-        if (l.coeff.empty()) break;
-        for (auto p : normalized_data)
+        if (l.coeff.empty())
         {
-            auto x = p.first;
-            if (abs(l.evaluate(x) - p.second) < threshold)
-                covered.insert(x);
+            checkpoint.discovery_complete = true;
+            break;
         }
-        affineFunctions.push_back(l);
+        cover(l);
+        checkpoint.functions.push_back(l);
+        if (elapsedSeconds(checkpoint_time) >= checkpoint_interval) saveCheckpoint();
     }
+    if (covered_count == num_points) checkpoint.discovery_complete = true;
+    saveCheckpoint();
 
+    if (affineFunctions.empty())
+    {
+        // No function could be found (too few points, or out of time): a single region with
+        // the regression over all points.
+        vector<int> ids;
+        for (int id = 0; id < num_points; id++) ids.push_back(id);
+        affineFunctions.push_back(trainModelUsingAlgLib(normalized_data, outputs, ids, num_vars, weights));
+    }
 #ifdef DEBUG
     std::cerr << "Found " << affineFunctions.size() << " regions!" << std::endl;
 #endif
+    profiler.addPhase("affine_discovery", elapsedSeconds(phase_start));
+    phase_start = std::chrono::steady_clock::now();
 
-    vector<int> cover_size;
+    // Weight of the points covered by each function.
+    vector<double> cover_size;
     for (int i = 0; i < affineFunctions.size(); i++)
         cover_size.push_back(0);
-    for (auto p : normalized_data)
+    for (int id = 0; id < num_points; id++)
     {
         for (int i = 0; i < affineFunctions.size(); i++)
         {
-            if (abs(affineFunctions[i].evaluate(p.first) - p.second) < threshold)
-                cover_size[i]++;
+            if (abs(affineFunctions[i].evaluate(normalized_data.at(id), num_vars) - outputs[id]) < threshold)
+                cover_size[i] += pointWeight(weights, id);
         }
     }
 
-    for (int i = 0; i < affineFunctions.size() - 1; i++)
+    // Regions finished before the checkpoint.
+    for (int k = 0; k < checkpoint.region_functions.size(); k++)
+    {
+        int j = checkpoint.region_functions[k];
+        piecewiseAffineModel::region r;
+        r.f = affineFunctions[j];
+        r.g = checkpoint.region_guards[k];
+        model.regions.push_back(r);
+        cover_size[j] = -1;
+    }
+
+    for (int i = checkpoint.region_functions.size(); i + 1 < affineFunctions.size(); i++)
     {
+        if (std::chrono::steady_clock::now() >= deadline)
+        {
+            // Out of time: the remaining regions are dropped, and their points are left to
+            // the last region.
+            std::cerr << "Time budget reached with " << affineFunctions.size() - i
+                      << " regions left." << std::endl;
+            break;
+        }
         int j = 0;
         for (int k = 0; k < affineFunctions.size(); k++)
         {
@@ -663,41 +1211,23 @@ piecewiseAffineModel learnModelFromData(const map<vector<float>, float>& data, f
             }
         }
         // Select j as the next region.
-        set<vector<float>> positive_points;
-        set<vector<float>> neg_points;
-        for (auto& p : normalized_data)
+        // The labelled points are ids into the normalized data, and are released once the
+        // guard for the region is learnt.
+        vector<int> positive_points;
+        vector<int> neg_points;
+        vector<char> has_region(affineFunctions.size());
+        for (int k = 0; k < affineFunctions.size(); k++) has_region[k] = cover_size[k] == -1;
+        for (int id = 0; id < num_points; id++)
         {
-            bool pos_label = false, neg_label = false;
-            bool already_labeled = false;
-            for (int k = 0; k < affineFunctions.size(); k++)
-            {
-                if (cover_size[k] == -1 &&
-                    abs(affineFunctions[k].evaluate(p.first) - p.second) < threshold)
-                    already_labeled = true;
-                    break;
-            }
-            if (already_labeled) continue;
-
-            if (abs(affineFunctions[j].evaluate(p.first) - p.second) < threshold)
-            {
-                pos_label = true;
-            }
-            for (int k = 0; k < affineFunctions.size(); k++)
-            {
-                if (cover_size[k] == -1 || k == j) continue;
-                if (abs(affineFunctions[k].evaluate(p.first) - p.second) < threshold)
-                {
-                    neg_label = true;
-                    break;
-                }
-            }
-            if (pos_label && !neg_label) 
+            int label = labelPoint(affineFunctions, has_region, j, normalized_data.at(id), outputs[id],
+                                   threshold, num_vars);
+            if (label == 1)
             {
-                positive_points.emplace(p.first);
+                positive_points.push_back(id);
             }
-            if (neg_label && !pos_label)
+            if (label == -1)
             {
-                neg_points.emplace(p.first);
+                neg_points.push_back(id);
             }
         }
 #ifdef DEBUG
@@ -705,8 +1235,37 @@ piecewiseAffineModel learnModelFromData(const map<vector<float>, float>& data, f
         std::cerr << "Number of positive points: " << positive_points.size()
                   << ", number of negative points: " << neg_points.size() << std::endl;
 #endif
-        guardPredicate g = genGuard(positive_points, neg_points,
-                                    num_vars);
+        auto region_start = std::chrono::steady_clock::now();
+        timePoint region_deadline = deadline;
+        if (time_budget > 0)
+        {
+            // The remaining time is shared among the remaining guards in proportion to the
+            // points covered by their functions (the largest one needs no guard), so that
+            // time left over by a region goes to the later ones.
+            double remaining_cover = 0, max_cover = 0;
+            for (int k = 0; k < affineFunctions.size(); k++)
+            {
+                if (cover_size[k] == -1) continue;
+                remaining_cover += cover_size[k];
+                max_cover = std::max(max_cover, cover_size[k]);
+            }
+            double share = cover_size[j]/std::max(1.0, remaining_cover - max_cover);
+            if (region_start < deadline)
+                region_deadline = region_start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                    (deadline - region_start)*std::min(1.0, share));
+        }
+        long long cegis_iterations = profiler.get(trainingProfiler::CEGIS_ITERATIONS);
+        long long splits = profiler.get(trainingProfiler::SPLITS);
+        guardPredicate g = genGuard(normalized_data, positive_points, neg_points,
+                                    num_vars, region_deadline);
+        trainingProfiler::regionProfile region_profile;
+        region_profile.region = model.regions.size();
+        region_profile.positive_points = positive_points.size();
+        region_profile.negative_points = neg_points.size();
+        region_profile.seconds = elapsedSeconds(region_start);
+        region_profile.cegis_iterations = profiler.get(trainingProfiler::CEGIS_ITERATIONS) - cegis_iterations;
+        region_profile.splits = profiler.get(trainingProfiler::SPLITS) - splits;
+        profiler.addRegion(region_profile);
         piecewiseAffineModel::region r;
         r.f = affineFunctions[j];
         r.g = g;
@@ -714,14 +1273,357 @@ piecewiseAffineModel learnModelFromData(const map<vector<float>, float>& data, f
 
         // set cover_size to -1, so it is not selected in the future.
         cover_size[j] = -1;
+
+        checkpoint.region_functions.push_back(j);
+        checkpoint.region_guards.push_back(g);
+        saveCheckpoint();
     }
-    // Add the remaining region.
-    int j = 0;
-    for (; cover_size[j] == -1; j++);
+    // Add the remaining region (the largest one, if regions were dropped).
+    int j = -1;
+    for (int k = 0; k < affineFunctions.size(); k++)
+        if (cover_size[k] != -1 && (j == -1 || cover_size[j] < cover_size[k])) j = k;
     piecewiseAffineModel::region r;
     r.f = affineFunctions[j];
     r.g = true_predicate(num_vars);
     model.regions.push_back(r); 
+    profiler.addPhase("guard_synthesis", elapsedSeconds(phase_start));
 
     return model;
 }
+
+// Marks the rows (raw inputs in the store) on which the error of the model is at least the
+// threshold. Returns the number of such rows.
+int markModelErrors(const piecewiseAffineModel& m, const pointStore& rows, const vector<float>& outputs,
+                    float threshold, vector<char>& wrong)
+{
+    const int chunk_size = 4096;
+    int num_vars = rows.num_vars;
+    int num_chunks = (rows.size() + chunk_size - 1)/chunk_size;
+    vector<int> chunk_errors(num_chunks, 0);
+    wrong.assign(rows.size(), false);
+    parallelFor(num_chunks, [&](int c)
+        {
+            vector<float> x(num_vars);
+            int end = std::min(rows.size(), (c + 1)*chunk_size);
+            for (int id = c*chunk_size; id < end; id++)
+            {
+                const float* p = rows.at(id);
+                for (int i = 0; i < num_vars; i++) x[i] = p[i]/m.scale_vec[i];
+                if (abs(m.evaluateNormalized(x.data(), num_vars) - outputs[id]) >= threshold)
+                {
+                    wrong[id] = true;
+                    chunk_errors[c]++;
+                }
+            }
+        });
+    int errors = 0;
+    for (int e : chunk_errors) errors += e;
+    return errors;
+}
+
+piecewiseAffineModel learnModelFromSample(const map<vector<float>, float>& data, float threshold)
+{
+    if (sample_size <= 0 || data.size() <= sample_size) return learnModelFromData(data, threshold);
+
+    // The time budget is for all the rounds: each round is given the time that remains.
+    double budget = time_budget;
+    auto sample_start = std::chrono::steady_clock::now();
+
+    int num_vars = data.begin()->first.size();
+    pointStore rows(num_vars);
+    vector<float> outputs;
+    rows.values.reserve(data.size()*num_vars);
+    outputs.reserve(data.size());
+    for (auto& p : data)
+    {
+        rows.add(p.first);
+        outputs.push_back(p.second);
+    }
+    int num_rows = rows.size();
+
+    // Stratified subsample: every (num_rows/sample_size)th row in order of the output.
+    vector<int> by_output(num_rows);
+    for (int id = 0; id < num_rows; id++) by_output[id] = id;
+    std::stable_sort(by_output.begin(), by_output.end(),
+                     [&](int a, int b) { return outputs[a] < outputs[b]; });
+    vector<char> in_sample(num_rows, false);
+    map<vector<float>, float> sample;
+    for (int k = 0; k < sample_size; k++)
+    {
+        int id = by_output[(long long)k*num_rows/sample_size];
+        in_sample[id] = true;
+        sample.emplace(rows.point(id), outputs[id]);
+    }
+
+    piecewiseAffineModel best;
+    float best_precision = -1.0;
+    vector<char> wrong;
+    for (int round = 0; round <= max_refinements; round++)
+    {
+        if (budget > 0)
+        {
+            time_budget = budget - elapsedSeconds(sample_start);
+            if (time_budget <= 0 && round > 0) break;
+            // learnModelFromData treats a budget of 0 as none.
+            time_budget = std::max(time_budget, 1e-6);
+        }
+        piecewiseAffineModel m = learnModelFromData(sample, threshold);
+        auto start = std::chrono::steady_clock::now();
+        int errors = markModelErrors(m, rows, outputs, threshold, wrong);
+        profiler.addPhase("full_data_pass", elapsedSeconds(start));
+        float precision = 1 - (float)errors/num_rows;
+        std::cerr << "Round " << round << ": " << sample.size() << " rows, training precision "
+                  << precision << std::endl;
+
+        bool improved = precision > best_precision + REFINEMENT_TOLERANCE;
+        if (precision > best_precision)
+        {
+            best = m;
+            best_precision = precision;
+        }
+        if (errors == 0 || !improved) break;
+
+        // Add the rows the model gets wrong, at most sample_size of them (evenly spread).
+        vector<int> new_rows;
+        for (int id = 0; id < num_rows; id++)
+            if (wrong[id] && !in_sample[id]) new_rows.push_back(id);
+        if (new_rows.empty()) break;
+        int count = std::min((int)new_rows.size(), sample_size);
+        for (int k = 0; k < count; k++)
+        {
+            int id = new_rows[(long long)k*new_rows.size()/count];
+            in_sample[id] = true;
+            sample.emplace(rows.point(id), outputs[id]);
+        }
+    }
+    time_budget = budget;
+    return best;
+}
+
+// Number of the points (ids in the store) that the regions predict within the threshold,
+// among the points that reach them (a point no region holds for is wrong).
+static int correctPredictions(const vector<piecewiseAffineModel::region>& regions, const pointStore& s,
+                              const vector<float>& outputs, const vector<int>& ids, float threshold)
+{
+    int correct = 0;
+    for (int id : ids)
+    {
+        for (auto& r : regions)
+        {
+            if (!r.g.evaluate(s.at(id), s.num_vars)) continue;
+            if (abs(r.f.evaluate(s.at(id), s.num_vars) - outputs[id]) < threshold) correct++;
+            break;
+        }
+    }
+    return correct;
+}
+
+int updateModel(piecewiseAffineModel& m, const map<vector<float>, float>& rows, float threshold,
+                const map<vector<float>, float>& previous)
+{
+    if (rows.empty() || m.regions.empty()) return 0;
+    int num_vars = m.scale_vec.size();
+
+    // The new rows and the previous rows (that are not new rows), normalized as the model.
+    pointStore s(num_vars);
+    vector<float> outputs;
+    vector<char> is_new;
+    auto add = [&](const vector<float>& input, float output, bool new_row)
+        {
+            if (input.size() != num_vars) return;
+            vector<float> x(num_vars);
+            for (int i = 0; i < num_vars; i++) x[i] = input[i]/m.scale_vec[i];
+            s.add(x);
+            outputs.push_back(output);
+            is_new.push_back(new_row);
+        };
+    for (auto& p : rows) add(p.first, p.second, true);
+    for (auto& p : previous)
+        if (rows.find(p.first) == rows.end()) add(p.first, p.second, false);
+    int num_points = s.size();
+    auto fits = [&](const affineFunction& f, int id)
+        {
+            return abs(f.evaluate(s.at(id), num_vars) - outputs[id]) < threshold;
+        };
+    vector<char> violated(num_points, false);
+    int violated_count = 0, new_count = 0;
+    for (int id = 0; id < num_points; id++)
+    {
+        if (!is_new[id]) continue;
+        new_count++;
+        if (abs(m.evaluateNormalized(s.at(id), num_vars) - outputs[id]) >= threshold)
+        {
+            violated[id] = true;
+            violated_count++;
+        }
+    }
+    if (violated_count == 0) return 0;
+
+    // The functions for the violated rows: the functions of the model, and new functions for
+    // the rows that none of them fits.
+    vector<affineFunction> functions;
+    for (auto& r : m.regions)
+        if (std::find(functions.begin(), functions.end(), r.f) == functions.end())
+            functions.push_back(r.f);
+    int model_functions = functions.size();
+    vector<char> covered(num_points, true);
+    int uncovered = 0;
+    for (int id = 0; id < num_points; id++)
+    {
+        if (!violated[id]) continue;
+        bool fit = false;
+        for (auto& f : functions)
+            if (fits(f, id)) fit = true;
+        if (!fit)
+        {
+            covered[id] = false;
+            uncovered++;
+        }
+    }
+    while (uncovered > 0)
+    {
+        affineFunction l = genAffineFunction(s, outputs, covered, threshold, num_vars);
+        if (l.coeff.empty()) break;
+        int new_covered = 0;
+        for (int id = 0; id < num_points; id++)
+        {
+            if (!covered[id] && fits(l, id))
+            {
+                covered[id] = true;
+                new_covered++;
+            }
+        }
+        if (new_covered == 0) break;
+        uncovered -= new_covered;
+        functions.push_back(l);
+    }
+
+    // The regions are updated in order, on the points that reach them. A region is affected if
+    // it holds for new rows it gets wrong; the other regions are left as they are. The function
+    // of an affected region is refit on its points (previous and new), and if no function fits
+    // them all:
+    // (1) Regions are added in front of it for the rows it gets wrong, one for each function
+    //     that fits some of them (new functions first), with a guard that separates these rows
+    //     from the points that reach the region and the function does not fit.
+    // (2) Its guard is learnt again, on the points that reach it and its function fits, against
+    //     the points its function does not fit (the last region is left as the fallback).
+    // Each added region and learnt guard is kept only if it does not reduce the number of
+    // points that reach it and are predicted within the threshold.
+    vector<piecewiseAffineModel::region> regions;
+    vector<int> reaching(num_points);
+    for (int id = 0; id < num_points; id++) reaching[id] = id;
+    int affected = 0, refits = 0, patches = 0, guards = 0, rejected = 0;
+    for (int i = 0; i < m.regions.size(); i++)
+    {
+        piecewiseAffineModel::region r = m.regions[i];
+        vector<piecewiseAffineModel::region> tail(m.regions.begin() + i, m.regions.end());
+        vector<int> captured, wrong;
+        for (int id : reaching)
+        {
+            if (!r.g.evaluate(s.at(id), num_vars)) continue;
+            captured.push_back(id);
+            if (violated[id] && !fits(r.f, id)) wrong.push_back(id);
+        }
+        if (!wrong.empty())
+        {
+            affected++;
+            affineFunction f = trainModelUsingAlgLib(s, outputs, captured, num_vars);
+            bool refit = !f.coeff.empty();
+            for (int id : captured)
+                if (refit && !fits(f, id)) refit = false;
+            if (refit)
+            {
+                r.f = f;
+                refits++;
+                wrong.clear();
+            }
+        }
+        if (!wrong.empty())
+        {
+            vector<vector<int>> assigned(functions.size());
+            for (int id : wrong)
+            {
+                for (int k = functions.size() - 1; k >= 0; k--)
+                {
+                    if (fits(functions[k], id))
+                    {
+                        assigned[k].push_back(id);
+                        break;
+                    }
+                }
+            }
+            for (int k = functions.size() - 1; k >= 0; k--)
+            {
+                if (assigned[k].empty()) continue;
+                vector<int> neg_points;
+                for (int id : reaching)
+                    if (!fits(functions[k], id)) neg_points.push_back(id);
+                piecewiseAffineModel::region patch;
+                patch.f = functions[k];
+                patch.g = genGuard(s, assigned[k], neg_points, num_vars, timePoint::max());
+                if (patch.g.clauses.empty()) continue;
+                vector<int> rest;
+                int patch_correct = 0;
+                for (int id : reaching)
+                {
+                    if (!patch.g.evaluate(s.at(id), num_vars)) rest.push_back(id);
+                    else if (fits(patch.f, id)) patch_correct++;
+                }
+                if (patch_correct + correctPredictions(tail, s, outputs, rest, threshold) <
+                    correctPredictions(tail, s, outputs, reaching, threshold))
+                {
+                    rejected++;
+                    continue;
+                }
+                regions.push_back(patch);
+                reaching.swap(rest);
+                patches++;
+            }
+
+            if (i + 1 < m.regions.size())
+            {
+                vector<int> pos_points, neg_points;
+                for (int id : reaching)
+                {
+                    if (!fits(r.f, id)) neg_points.push_back(id);
+                    else if (r.g.evaluate(s.at(id), num_vars)) pos_points.push_back(id);
+                }
+                // Without points its function fits, the region is dropped (an empty guard).
+                piecewiseAffineModel::region updated = r;
+                if (!pos_points.empty())
+                    updated.g = genGuard(s, pos_points, neg_points, num_vars, timePoint::max());
+                else
+                    updated.g = guardPredicate();
+                // If no guard is found, the region is left as it is.
+                if (pos_points.empty() || !updated.g.clauses.empty())
+                {
+                    vector<piecewiseAffineModel::region> updated_tail = tail;
+                    updated_tail[0] = updated;
+                    if (correctPredictions(updated_tail, s, outputs, reaching, threshold) <
+                        correctPredictions(tail, s, outputs, reaching, threshold))
+                    {
+                        rejected++;
+                    }
+                    else
+                    {
+                        r = updated;
+                        guards++;
+                    }
+                }
+            }
+        }
+        if (r.g.clauses.empty()) continue;
+        regions.push_back(r);
+        vector<int> rest;
+        for (int id : reaching)
+            if (!r.g.evaluate(s.at(id), num_vars)) rest.push_back(id);
+        reaching.swap(rest);
+    }
+    std::cerr << "Updated the model for " << violated_count << " of " << new_count << " new rows (with "
+              << num_points - new_count << " previous rows): " << affected << " affected regions, "
+              << refits << " refit functions, " << functions.size() - model_functions << " new functions, "
+              << patches << " new regions, " << guards << " new guards and " << rejected
+              << " rejected updates." << std::endl;
+    m.regions.swap(regions);
+    return affected;
+}
@@ -0,0 +1,170 @@
+#include "mosaic.h"
+#include "Parallel.hpp"
+#include "Solvers.hpp"
+#include "utils.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <sstream>
+
+// The C interface (see mosaic.h). No exception crosses it: errors are reported through
+// mosaic_last_error.
+
+using namespace std;
+
+struct mosaic_model
+{
+    piecewiseAffineModel m;
+};
+
+static thread_local string last_error;
+
+// Runs fn, turning an exception into the error message and `failed`.
+template <typename T, typename F>
+static T guarded(T failed, F fn)
+{
+    last_error.clear();
+    try
+    {
+        return fn();
+    }
+    catch (const std::exception& e)
+    {
+        last_error = e.what();
+    }
+    catch (...)
+    {
+        last_error = "unknown error";
+    }
+    return failed;
+}
+
+static mosaic_model* parseModel(const string& serialized)
+{
+    auto m = parseModelJSON(boost::json::parse(serialized).as_object());
+    if (m.regions.empty())
+    {
+        last_error = "model has no regions";
+        return nullptr;
+    }
+    auto model = new mosaic_model;
+    model->m = m;
+    return model;
+}
+
+mosaic_model* mosaic_load_model_file(const char* path)
+{
+    return guarded<mosaic_model*>(nullptr, [&]() -> mosaic_model*
+        {
+            ifstream fs(path);
+            if (!fs.is_open())
+            {
+                last_error = string("cannot open ") + path;
+                return nullptr;
+            }
+            stringstream serialized;
+            serialized << fs.rdbuf();
+            return parseModel(serialized.str());
+        });
+}
+
+mosaic_model* mosaic_load_model_buffer(const char* json, size_t length)
+{
+    return guarded<mosaic_model*>(nullptr, [&]() { return parseModel(string(json, length)); });
+}
+
+mosaic_model* mosaic_train(const float* inputs, const float* outputs, long long rows, int num_inputs,
+                           float threshold)
+{
+    return guarded<mosaic_model*>(nullptr, [&]() -> mosaic_model*
+        {
+            if (rows <= 0 || num_inputs <= 0)
+            {
+                last_error = "no training data";
+                return nullptr;
+            }
+            map<vector<float>, float> data;
+            for (long long r = 0; r < rows; r++)
+                data.emplace(vector<float>(inputs + r*num_inputs, inputs + (r + 1)*num_inputs), outputs[r]);
+            auto m = learnModelFromData(data, threshold);
+            auto model = new mosaic_model;
+            model->m = m;
+            return model;
+        });
+}
+
+void mosaic_set_num_threads(int threads)
+{
+    num_threads = threads < 1 ? 1 : threads;
+}
+
+int mosaic_num_inputs(const mosaic_model* model)
+{
+    return model->m.scale_vec.size();
+}
+
+float mosaic_evaluate(const mosaic_model* model, const float* input, int num_inputs)
+{
+    float output = 0.0;
+    mosaic_evaluate_batch(model, input, 1, num_inputs, &output);
+    return output;
+}
+
+int mosaic_evaluate_batch(const mosaic_model* model, const float* inputs, long long rows, int num_inputs,
+                          float* outputs)
+{
+    const piecewiseAffineModel& m = model->m;
+    last_error.clear();
+    if (num_inputs != m.scale_vec.size())
+    {
+        last_error = "the model has " + to_string(m.scale_vec.size()) + " inputs";
+        return -1;
+    }
+    vector<float> x(num_inputs);
+    for (long long r = 0; r < rows; r++)
+    {
+        const float* input = inputs + r*num_inputs;
+        for (int i = 0; i < num_inputs; i++) x[i] = input[i]/m.scale_vec[i];
+        outputs[r] = m.evaluateNormalized(x.data(), num_inputs);
+    }
+    return 0;
+}
+
+char* mosaic_model_to_json(const mosaic_model* model, size_t* length)
+{
+    return guarded<char*>(nullptr, [&]()
+        {
+            string serialized = boost::json::serialize(outputModelJSON(model->m));
+            char* json = (char*)malloc(serialized.size() + 1);
+            memcpy(json, serialized.c_str(), serialized.size() + 1);
+            if (length) *length = serialized.size();
+            return json;
+        });
+}
+
+int mosaic_save_model(const mosaic_model* model, const char* path)
+{
+    return guarded<int>(-1, [&]()
+        {
+            if (writeJSON(outputModelJSON(model->m), path)) return 0;
+            last_error = string("cannot write ") + path;
+            return -1;
+        });
+}
+
+void mosaic_free_string(char* json)
+{
+    free(json);
+}
+
+void mosaic_free_model(mosaic_model* model)
+{
+    delete model;
+}
+
+const char* mosaic_last_error(void)
+{
+    return last_error.c_str();
+}
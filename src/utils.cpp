@@ -1,22 +1,84 @@
 #include "utils.hpp"
+#include "Parallel.hpp"
 
+#include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <string>
 
 // #define DEBUG
-std::map<std::vector<float>, float> loadData(const std::string& path)
+
+// Global configurations
+int num_threads = 1;
+unsigned int random_seed = 0;
+
+// Adds a row to the data set (rows with a different number of inputs than the first row are
+// counted in `skipped`). Negative zeros are stored as zeros, so that equal inputs have equal bits.
+void addRow(dataSet& d, const float* x, int num_vars, float y, long long& skipped)
 {
-    std::map<std::vector<float>, float> m;
+    if (d.outputs.empty()) d.num_vars = num_vars;
+    if (num_vars != d.num_vars)
+    {
+        skipped++;
+        return;
+    }
+    for (int i = 0; i < num_vars; i++) d.inputs.push_back(x[i] == 0.0f ? 0.0f : x[i]);
+    d.outputs.push_back(y);
+    d.weights.push_back(1.0);
+}
+
+void loadBinaryData(FILE* fp, const binaryDataHeader& header, dataSet& d, long long& skipped)
+{
+    int row_size = header.num_vars + 1;
+    const long long rows_per_read = 1 << 16;
+    std::vector<float> buf;
+    d.inputs.reserve(header.rows*header.num_vars);
+    d.outputs.reserve(header.rows);
+    d.weights.reserve(header.rows);
+    for (long long row = 0; row < header.rows; row += rows_per_read)
+    {
+        long long count = std::min(rows_per_read, header.rows - row);
+        buf.resize(count*row_size);
+        if (std::fread(buf.data(), sizeof(float), buf.size(), fp) != buf.size())
+        {
+            std::cerr << "Unexpected end of binary data after " << row << " rows." << std::endl;
+            return;
+        }
+        for (long long i = 0; i < count; i++)
+        {
+            const float* x = buf.data() + i*row_size;
+            addRow(d, x, header.num_vars, x[header.num_vars], skipped);
+        }
+    }
+}
+
+// Reads every row of the data file, in file order, with weight 1.
+dataSet loadRows(const std::string& path)
+{
+    dataSet d;
+    long long skipped = 0;
     FILE* fp = std::fopen(path.c_str(), "r");
     if (!fp)
     {
         std::cerr << "Could not open file for loading data: " << path << std::endl;
-        return m;
+        return d;
     }
 
+    binaryDataHeader header;
+    if (std::fread(&header, sizeof(header), 1, fp) == 1 &&
+        std::memcmp(header.magic, BINARY_DATA_MAGIC, sizeof(header.magic)) == 0)
+    {
+        loadBinaryData(fp, header, d, skipped);
+        std::fclose(fp);
+        if (skipped > 0) std::cerr << "Skipped " << skipped << " rows with a different number of inputs." << std::endl;
+        return d;
+    }
+    std::rewind(fp);
+
     // Format of the data:
     // Each line consists of one input output pair.
     // The values are comma separated with the last value as the output.
@@ -40,7 +102,7 @@ std::map<std::vector<float>, float> loadData(const std::string& path)
             if (end_pos == std::string::npos)
             {
                 try {
-                    m.emplace(input, (float)std::stod(buf.substr(pos).c_str()));
+                    addRow(d, input.data(), input.size(), (float)std::stod(buf.substr(pos).c_str()), skipped);
                 }
                 catch(std::exception& e)
                 {
@@ -63,9 +125,172 @@ std::map<std::vector<float>, float> loadData(const std::string& path)
         buf.clear();
     }
     std::fclose(fp);
+    if (skipped > 0) std::cerr << "Skipped " << skipped << " rows with a different number of inputs." << std::endl;
+    return d;
+}
+
+// Hash of the bits of `count` floats (64-bit FNV-1a over 32-bit words, then a final mix).
+static unsigned long long hashFloats(const float* x, int count, unsigned long long h = 14695981039346656037ULL)
+{
+    for (int i = 0; i < count; i++)
+    {
+        uint32_t bits;
+        std::memcpy(&bits, x + i, sizeof(bits));
+        h = (h ^ bits)*1099511628211ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+dataSet dedupeData(const dataSet& rows, duplicatePolicy policy)
+{
+    int n = rows.num_vars;
+    long long num_rows = rows.size();
+    bool by_output = policy == KEEP_ALL_DUPLICATES;
+    // Open addressing table of the first row of each distinct key (the input, and the output
+    // when all rows are kept), with at most half of the slots used.
+    long long capacity = 1;
+    while (capacity < 2*num_rows) capacity <<= 1;
+    std::vector<long long> slots(capacity, -1);
+    // The first row of each distinct key in order of appearance, with the sums of the outputs
+    // (weighted) and of the weights of its rows.
+    std::vector<long long> firsts;
+    std::vector<double> output_sums, weight_sums;
+    for (long long r = 0; r < num_rows; r++)
+    {
+        const float* x = rows.at(r);
+        unsigned long long h = hashFloats(x, n);
+        if (by_output) h = hashFloats(&rows.outputs[r], 1, h);
+        long long slot = h & (capacity - 1);
+        while (true)
+        {
+            long long u = slots[slot];
+            if (u == -1)
+            {
+                slots[slot] = firsts.size();
+                firsts.push_back(r);
+                output_sums.push_back((double)rows.outputs[r]*rows.weights[r]);
+                weight_sums.push_back(rows.weights[r]);
+                break;
+            }
+            long long first = firsts[u];
+            if (std::memcmp(rows.at(first), x, n*sizeof(float)) == 0 &&
+                (!by_output || rows.outputs[first] == rows.outputs[r]))
+            {
+                output_sums[u] += (double)rows.outputs[r]*rows.weights[r];
+                weight_sums[u] += rows.weights[r];
+                break;
+            }
+            slot = (slot + 1) & (capacity - 1);
+        }
+    }
+
+    // The distinct rows in the order of their inputs (and outputs), as a map would keep them.
+    std::vector<long long> order(firsts.size());
+    for (long long u = 0; u < order.size(); u++) order[u] = u;
+    std::sort(order.begin(), order.end(), [&](long long a, long long b)
+        {
+            const float* xa = rows.at(firsts[a]);
+            const float* xb = rows.at(firsts[b]);
+            if (std::lexicographical_compare(xa, xa + n, xb, xb + n)) return true;
+            if (std::lexicographical_compare(xb, xb + n, xa, xa + n)) return false;
+            return rows.outputs[firsts[a]] < rows.outputs[firsts[b]];
+        });
+
+    dataSet d;
+    d.num_vars = n;
+    d.inputs.reserve(order.size()*n);
+    for (long long u : order)
+    {
+        const float* x = rows.at(firsts[u]);
+        d.inputs.insert(d.inputs.end(), x, x + n);
+        if (policy == AVERAGE_DUPLICATES)
+            d.outputs.push_back(output_sums[u]/weight_sums[u]);
+        else
+            d.outputs.push_back(rows.outputs[firsts[u]]);
+        d.weights.push_back(policy == KEEP_FIRST_DUPLICATE ? rows.weights[firsts[u]] : weight_sums[u]);
+    }
+    return d;
+}
+
+long long resolveConflicts(dataSet& d)
+{
+    int n = d.num_vars;
+    dataSet resolved;
+    resolved.num_vars = n;
+    long long merged = 0;
+    for (long long r = 0; r < d.size();)
+    {
+        // Rows with the same input are adjacent, in the order of their outputs.
+        long long end = r + 1;
+        double total = d.weights[r];
+        while (end < d.size() && std::memcmp(d.at(r), d.at(end), n*sizeof(float)) == 0)
+        {
+            total += d.weights[end];
+            end++;
+        }
+        long long median = r;
+        for (double below = d.weights[r]; 2*below < total; below += d.weights[median]) median++;
+        resolved.inputs.insert(resolved.inputs.end(), d.at(r), d.at(r) + n);
+        resolved.outputs.push_back(d.outputs[median]);
+        resolved.weights.push_back(total);
+        merged += end - r - 1;
+        r = end;
+    }
+    d = resolved;
+    return merged;
+}
+
+bool parseDuplicatePolicy(const std::string& name, duplicatePolicy& policy)
+{
+    if (name == "first") policy = KEEP_FIRST_DUPLICATE;
+    else if (name == "average") policy = AVERAGE_DUPLICATES;
+    else if (name == "all") policy = KEEP_ALL_DUPLICATES;
+    else
+    {
+        std::cerr << "Unknown duplicate policy: " << name << " (first, average or all)." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+dataSet loadDataSet(const std::string& path, duplicatePolicy policy)
+{
+    return dedupeData(loadRows(path), policy);
+}
+
+std::map<std::vector<float>, float> dataMap(const dataSet& d)
+{
+    // The rows are in the order of the map (the first of rows with the same input is kept).
+    std::map<std::vector<float>, float> m;
+    for (long long r = 0; r < d.size(); r++)
+        m.emplace_hint(m.end(), std::vector<float>(d.at(r), d.at(r) + d.num_vars), d.outputs[r]);
     return m;
 }
 
+dataSet toDataSet(const std::map<std::vector<float>, float>& data)
+{
+    dataSet d;
+    if (data.empty()) return d;
+    d.num_vars = data.begin()->first.size();
+    d.inputs.reserve(data.size()*d.num_vars);
+    for (auto& p : data)
+    {
+        if (p.first.size() != d.num_vars) continue;
+        d.inputs.insert(d.inputs.end(), p.first.begin(), p.first.end());
+        d.outputs.push_back(p.second);
+        d.weights.push_back(1.0);
+    }
+    return d;
+}
+
+std::map<std::vector<float>, float> loadData(const std::string& path)
+{
+    return dataMap(loadDataSet(path, KEEP_FIRST_DUPLICATE));
+}
+
 boost::json::object loadModelJSON(const std::string& model_path)
 {
     std::fstream fs;
@@ -84,7 +309,23 @@ boost::json::object loadModelJSON(const std::string& model_path)
     return model_jv.as_object();
 }
 
+bool writeJSON(const boost::json::object& obj, const std::string& path)
+{
+    std::fstream fs;
+    fs.open(path, std::ios::out);
+    if (!fs.is_open()) return false;
+
+    boost::json::serializer sr;
+    sr.reset( &obj );
+    while( ! sr.done() )
+    {
+        char buf[ 4000 ];
+        fs << sr.read( buf );
+    }
 
+    fs.close();
+    return true;
+}
 
 std::string vectorString(const std::vector<float>& v)
 {
@@ -321,11 +562,23 @@ piecewiseAffineModel parseModelJSON(const boost::json::object& model_json)
     return m;
 }
 
+void rescaleCoefficients(std::vector<float>& coeff, const std::vector<float>& from,
+                         const std::vector<float>& to)
+{
+    for (int i = 0; i < from.size() && i < coeff.size(); i++)
+        coeff[i] *= to[i]/from[i];
+}
+
 float distance(const std::vector<float>& p1, const std::vector<float>& p2)
+{
+    return distance(p1.data(), p2.data(), p1.size());
+}
+
+float distance(const float* p1, const float* p2, int n)
 {
     // returns distance between p1 and p2 in the vector space using L2 norm.
     float dist = 0.0;
-    for (int i = 0; i < p1.size(); i++)
+    for (int i = 0; i < n; i++)
     {
         dist += (p1[i]-p2[i])*(p1[i]-p2[i]);
     }
@@ -364,6 +617,21 @@ guardPredicate false_predicate(int n)
     return g;
 }
 
+unsigned long long splitmix64(unsigned long long x)
+{
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30))*0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27))*0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+float counterRandom(unsigned long long seed, unsigned long long stream, unsigned long long counter)
+{
+    unsigned long long x = splitmix64(splitmix64(splitmix64(seed) ^ stream) ^ counter);
+    // Top 24 bits give a float in [0, 1) without rounding up to 1.
+    return (x >> 40)*(1.0f/16777216.0f);
+}
+
 bool contains_value(std::string config)
 {
     return config.find_first_of("=") != std::string::npos;
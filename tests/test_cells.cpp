@@ -0,0 +1,67 @@
+// Tests of the training by cells (see Cells.hpp).
+#include "Cells.hpp"
+#include "Solvers.hpp"
+
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <vector>
+
+// Data with a binary input (set for 30% of the rows), which is the widest normalized input, so
+// that the first split is on it and leaves it 0 over the cell below the split.
+std::map<std::vector<float>, float> binaryFeatureData()
+{
+    std::map<std::vector<float>, float> data;
+    for (int k = 0; k < 1000; k++)
+    {
+        float b = k % 10 < 3 ? 1.0 : 0.0;
+        float x = (k % 97)/96.0;
+        data[{b, x, (float)(k % 7)}] = b == 1.0 ? 2*x + 1 : x + 3;
+    }
+    return data;
+}
+
+bool finiteModel(const piecewiseAffineModel& m)
+{
+    for (float c : m.scale_vec)
+        if (!std::isfinite(c)) return false;
+    for (auto& r : m.regions)
+    {
+        for (float c : r.f.coeff)
+            if (!std::isfinite(c)) return false;
+        for (auto& cl : r.g.clauses)
+            for (auto& t : cl.terms)
+                for (float c : t.coeff)
+                    if (!std::isfinite(c)) return false;
+    }
+    return true;
+}
+
+int main()
+{
+    float threshold = 0.1;
+    auto data = binaryFeatureData();
+    num_cells = 2;
+    piecewiseAffineModel m = learnModelByCells(data, threshold);
+
+    int failures = 0;
+    if (!finiteModel(m))
+    {
+        std::cerr << "FAIL: the model by cells split on a binary input has non-finite coefficients." << std::endl;
+        failures++;
+    }
+    int errors = 0;
+    for (auto& p : data)
+    {
+        float y = m.evaluate(p.first);
+        if (!(std::abs(y - p.second) < threshold)) errors++;
+    }
+    if (errors > 0)
+    {
+        std::cerr << "FAIL: the model by cells split on a binary input gets " << errors << " of "
+                  << data.size() << " rows wrong." << std::endl;
+        failures++;
+    }
+    if (failures == 0) std::cout << "test_cells: OK" << std::endl;
+    return failures == 0 ? 0 : 1;
+}
@@ -1,6 +1,15 @@
+#include "AlgLibUtils.hpp"
+#include "Cells.hpp"
+#include "Compact.hpp"
+#include "OutOfCore.hpp"
+#include "Parallel.hpp"
+#include "Profiler.hpp"
+#include "SolverCapture.hpp"
 #include "Solvers.hpp"
 #include "utils.hpp"
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <fstream>
 #include <string>
@@ -70,13 +79,57 @@ int main(int argc, char** argv)
                   << " The file path to output learnt model." << std::endl;
         std::cout << " -s <value> | --num_splits <value>: "
                   << "Number of split iterations during guard predicate training." << std::endl;
+        std::cout << " -b <value> | --batch_size <value>: "
+                  << "Number of counterexamples processed per guard iteration (0 for all)." << std::endl;
+        std::cout << " --simplify_candidates <value>: "
+                  << "Number of nearest groups checked for each merge while simplifying guards (0 for all)." << std::endl;
+        std::cout << " -m | --max_margin: "
+                  << "Learn guard predicates that maximize the margin from training points." << std::endl;
+        std::cout << " -j <value> | --threads <value>: "
+                  << "Number of threads used for the parallel steps of the training." << std::endl;
+        std::cout << " --seed <value>: "
+                  << "Seed for the randomized steps of the training." << std::endl;
+        std::cout << " --profile <path>: "
+                  << "The file path to output a JSON profile of the training." << std::endl;
+        std::cout << " --time_budget <seconds>: "
+                  << "Wall-clock budget for the training; the model learnt by then is output." << std::endl;
+        std::cout << " --sample <rows>: "
+                  << "Train on a subsample of the data, refined with the rows the model gets wrong." << std::endl;
+        std::cout << " --refinements <value>: "
+                  << "Maximum number of refinement rounds with --sample (default 10)." << std::endl;
+        std::cout << " --cells <value>: "
+                  << "Split the input space into this many cells, learnt in parallel and stitched into one model." << std::endl;
+        std::cout << " --duplicates <policy>: "
+                  << "Rows with the same inputs: keep the first (first, default), average their outputs (average), or keep "
+                  << "each output with the number of its rows as weight (all); weights are used by the default training." << std::endl;
+        std::cout << " --out_of_core: "
+                  << "Stream the training over the (binary) data file mapped into memory, instead of loading it "
+                  << "(without --compact, --cells, --sample, --update, --init, --duplicates or checkpoints)." << std::endl;
+        std::cout << " --resident_points <value>: "
+                  << "Maximum number of rows kept in memory for a regression with --out_of_core (default 100000)." << std::endl;
+        std::cout << " --compact: "
+                  << "Compact the learnt model (drop the regions and predicates the training data does not need)." << std::endl;
+        std::cout << " --init <path>: "
+                  << "Warm start the training from the model at the path (e.g. the model of a previous training)." << std::endl;
+        std::cout << " --update <path>: "
+                  << "Update the model at the path for the data, instead of learning a new model." << std::endl;
+        std::cout << " --previous_data <path>: "
+                  << "The data the model was learnt from (or a sample of it), kept predicted by the regions of the model with --update." << std::endl;
+        std::cout << " --checkpoint <path>: "
+                  << "The file path to checkpoint the training to, to resume it later." << std::endl;
+        std::cout << " --checkpoint_interval <seconds>: "
+                  << "Minimum time between checkpoints while learning affine functions (default 60)." << std::endl;
+        std::cout << " --resume: "
+                  << "Resume the training from the checkpoint." << std::endl;
+        std::cout << " --capture <path>: "
+                  << "The file path to capture the solver calls of the training (see bench_solvers)." << std::endl;
         std::cout << " -h | --help: "
                   << "Usage and options for the model training." << std::endl;
         return 0;
     }
 
     float threshold = 0.5;
-    std::string path_to_train_data, path_to_output_model;
+    std::string path_to_train_data, path_to_output_model, path_to_profile;
     if (config_map.find("t") != config_map.end())
     {
         threshold = std::stof(config_map["t"]);
@@ -101,12 +154,187 @@ int main(int argc, char** argv)
     {
         num_splits = std::stoi(config_map["num_splits"]);
     }
+    if (config_map.find("b") != config_map.end())
+    {
+        ce_batch_size = std::stoi(config_map["b"]);
+    }
+    if (config_map.find("batch_size") != config_map.end())
+    {
+        ce_batch_size = std::stoi(config_map["batch_size"]);
+    }
+    if (config_map.find("simplify_candidates") != config_map.end())
+    {
+        simplify_candidates = std::stoi(config_map["simplify_candidates"]);
+    }
+    if (config_map.find("m") != config_map.end() ||
+        config_map.find("max_margin") != config_map.end())
+    {
+        max_margin = true;
+    }
+    if (config_map.find("j") != config_map.end())
+    {
+        num_threads = std::stoi(config_map["j"]);
+    }
+    if (config_map.find("threads") != config_map.end())
+    {
+        num_threads = std::stoi(config_map["threads"]);
+    }
+    if (config_map.find("seed") != config_map.end())
+    {
+        random_seed = std::stoul(config_map["seed"]);
+    }
+    if (config_map.find("profile") != config_map.end())
+    {
+        path_to_profile = config_map["profile"];
+    }
+    if (config_map.find("time_budget") != config_map.end())
+    {
+        time_budget = std::stod(config_map["time_budget"]);
+    }
+    if (config_map.find("sample") != config_map.end())
+    {
+        sample_size = std::stoi(config_map["sample"]);
+    }
+    if (config_map.find("refinements") != config_map.end())
+    {
+        max_refinements = std::stoi(config_map["refinements"]);
+    }
+    if (config_map.find("cells") != config_map.end())
+    {
+        num_cells = std::stoi(config_map["cells"]);
+    }
+    bool compact = false;
+    if (config_map.find("compact") != config_map.end())
+    {
+        compact = true;
+    }
+    if (config_map.find("init") != config_map.end())
+    {
+        initial_model = parseModelJSON(loadModelJSON(config_map["init"]));
+    }
+    std::string path_to_update_model;
+    if (config_map.find("update") != config_map.end())
+    {
+        path_to_update_model = config_map["update"];
+    }
+    std::string path_to_previous_data;
+    if (config_map.find("previous_data") != config_map.end())
+    {
+        path_to_previous_data = config_map["previous_data"];
+    }
+    duplicatePolicy duplicates = KEEP_FIRST_DUPLICATE;
+    if (config_map.find("duplicates") != config_map.end())
+    {
+        if (!parseDuplicatePolicy(config_map["duplicates"], duplicates)) return 0;
+    }
+    bool out_of_core = false;
+    if (config_map.find("out_of_core") != config_map.end())
+    {
+        out_of_core = true;
+    }
+    if (config_map.find("resident_points") != config_map.end())
+    {
+        resident_points = std::stoi(config_map["resident_points"]);
+    }
+    if (config_map.find("checkpoint") != config_map.end())
+    {
+        checkpoint_path = config_map["checkpoint"];
+    }
+    if (config_map.find("checkpoint_interval") != config_map.end())
+    {
+        checkpoint_interval = std::stod(config_map["checkpoint_interval"]);
+    }
+    if (config_map.find("resume") != config_map.end())
+    {
+        resume_from_checkpoint = true;
+    }
+    if (config_map.find("capture") != config_map.end())
+    {
+        if (!capture.open(config_map["capture"])) return 0;
+    }
     path_to_train_data = argv[argc - 1];
 
-    std::cout << "Loading data ... " << std::endl;
-    auto data = loadData(path_to_train_data);
-    std::cout << "Training piecewise affine model." << std::endl;
-    auto m = learnModelFromData(data, threshold);
+    auto start = std::chrono::steady_clock::now();
+    piecewiseAffineModel m;
+    if (out_of_core)
+    {
+        // The options of the training on loaded data.
+        for (const char* option : {"compact", "cells", "sample", "update", "previous_data", "init",
+                                   "duplicates", "checkpoint", "resume"})
+        {
+            if (config_map.find(option) != config_map.end())
+            {
+                std::cerr << "--" << option << " is not supported with --out_of_core." << std::endl;
+                return 1;
+            }
+        }
+        mappedData data;
+        if (!data.open(path_to_train_data)) return 1;
+        std::cout << "Training piecewise affine model out of core." << std::endl;
+        m = learnModelFromMappedData(data, threshold);
+        capture.close();
+
+        if (data.rows > 0)
+            std::cout << "Training precision: "
+                      << 1 - ((double)mappedDataErrors(m, data, threshold)/data.rows) << std::endl;
+    }
+    else
+    {
+        std::cout << "Loading data ... " << std::endl;
+        // The rows (with their weights), and the data the model is learnt from: a function
+        // has one output for an input, so conflicting outputs are merged into their median.
+        auto rows = loadDataSet(path_to_train_data, duplicates);
+        auto weighted_data = rows;
+        if (duplicates == KEEP_ALL_DUPLICATES)
+        {
+            long long conflicts = resolveConflicts(weighted_data);
+            if (conflicts > 0)
+                std::cout << "Merged " << conflicts << " rows with conflicting outputs for the same inputs." << std::endl;
+        }
+        auto data = dataMap(weighted_data);
+        profiler.addPhase("load", elapsedSeconds(start));
+        if (time_budget > 0)
+        {
+            // The budget covers loading the data, at least a second is left for the training.
+            time_budget = std::max(1.0, time_budget - elapsedSeconds(start));
+        }
+        std::cout << "Training piecewise affine model." << std::endl;
+        if (!path_to_update_model.empty())
+        {
+            m = parseModelJSON(loadModelJSON(path_to_update_model));
+            std::map<std::vector<float>, float> previous;
+            if (!path_to_previous_data.empty()) previous = loadData(path_to_previous_data);
+            updateModel(m, data, threshold, previous);
+        }
+        else if (num_cells > 1)
+            m = learnModelByCells(data, threshold);
+        else if (sample_size > 0)
+            m = learnModelFromSample(data, threshold);
+        else
+            m = learnModelFromData(weighted_data, threshold);
+        capture.close();
+
+        if (compact)
+        {
+            auto compact_start = std::chrono::steady_clock::now();
+            auto stats = compactModel(m, data, threshold);
+            profiler.addPhase("compact", elapsedSeconds(compact_start));
+            std::cout << "Compacted the model from " << stats.regions_before << " regions and "
+                      << stats.predicates_before << " predicates to " << stats.regions_after << " regions and "
+                      << stats.predicates_after << " predicates." << std::endl;
+        }
+
+        // Over the rows, counted with their weights.
+        double error_weight = 0.0, total_weight = 0.0;
+        for (long long r = 0; r < rows.size(); r++)
+        {
+            std::vector<float> input(rows.at(r), rows.at(r) + rows.num_vars);
+            if (std::abs(m.evaluate(input) - rows.outputs[r]) >= threshold) error_weight += rows.weights[r];
+            total_weight += rows.weights[r];
+        }
+        if (rows.size() > 0)
+            std::cout << "Training precision: " << 1 - (float)(error_weight/total_weight) << std::endl;
+    }
     if (path_to_output_model.empty())
     {
         std::cout << "Model Output: " << std::endl;
@@ -115,20 +343,13 @@ int main(int argc, char** argv)
     else
     {
         auto model_json = outputModelJSON(m);
-        //boost::json::serialize(model_json, path_to_output_model);
-        std::fstream fs;
-        fs.open(path_to_output_model, std::ios::out);
-        if (!fs.is_open()) return 0;
-
-        boost::json::serializer sr;
-        sr.reset( &model_json );
-        while( ! sr.done() )
-        {
-            char buf[ 4000 ];
-            fs << sr.read( buf );
-        }
+        if (!writeJSON(model_json, path_to_output_model)) return 0;
+    }
 
-        fs.close();
+    if (!path_to_profile.empty())
+    {
+        profiler.addPhase("total", elapsedSeconds(start));
+        writeJSON(profiler.toJSON(), path_to_profile);
     }
 
     return 0;
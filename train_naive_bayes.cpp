@@ -1,4 +1,6 @@
+#include "Parallel.hpp"
 #include "utils.hpp"
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <map>
@@ -7,6 +9,36 @@
 #include "boost/json.hpp"
 
 
+// Running count, mean and sum of squared deviations of a feature (Welford's algorithm).
+struct welfordAccumulator
+{
+    long long count = 0;
+    double mean = 0.0, m2 = 0.0;
+
+    void add(double x)
+    {
+        count++;
+        double delta = x - mean;
+        mean += delta/count;
+        m2 += delta*(x - mean);
+    }
+
+    // Merges the statistics of another set of values (Chan et al.).
+    void merge(const welfordAccumulator& a)
+    {
+        if (a.count == 0) return;
+        long long total = count + a.count;
+        double delta = a.mean - mean;
+        mean += delta*a.count/total;
+        m2 += a.m2 + delta*delta*((double)count*a.count/total);
+        count = total;
+    }
+};
+
+// Rows are split into this many chunks (independently of the number of threads), whose
+// statistics are merged in order, so that the model does not depend on the number of threads.
+#define NB_CHUNKS 16
+
 boost::json::object learnNaiveBayesModelFromData(
     const std::map<std::vector<float>, float>& data)
 {
@@ -23,40 +55,61 @@ boost::json::object learnNaiveBayesModelFromData(
     // Map from xi, y to distribution params. Xi is captured by index number.
     std::map<std::pair<int, float>, float> mean_xy;
     std::map<std::pair<int, float>, float> var_xy;
-
-    // Compute P(y)
-    std::map<float, int> ycounts;
+    if (data.empty()) return boost::json::object();
+
+    // The rows in a flat array, and the class (index of the output value) of each row.
+    int num_vars = data.begin()->first.size();
+    std::vector<float> rows;
+    std::vector<float> outputs;
+    rows.reserve(data.size()*num_vars);
+    outputs.reserve(data.size());
+    std::map<float, int> classes;
     for (auto& p : data)
     {
-        auto y = p.second;
-        if (ycounts.find(y) == ycounts.end())
-        {
-            ycounts.emplace(y, 1);
-        }
-        else
-            ycounts[y]++;
+        rows.insert(rows.end(), p.first.begin(), p.first.end());
+        outputs.push_back(p.second);
+        classes.emplace(p.second, 0);
     }
-    for (auto ycount: ycounts)
+    std::vector<float> ys;
+    for (auto& c : classes)
     {
-        prob_y.emplace(ycount.first, ((float)ycount.second)/data.size());
+        c.second = ys.size();
+        ys.push_back(c.first);
     }
+    int num_classes = ys.size();
 
-    for (auto ycount: ycounts)
-    {
-        auto y = ycount.first;
-        auto count = ycount.second;
-        for (int i = 0; i < data.begin()->first.size(); i++)
+    // One pass over the rows: accumulators per chunk, per class and feature.
+    int num_rows = outputs.size();
+    int chunk_size = (num_rows + NB_CHUNKS - 1)/NB_CHUNKS;
+    std::vector<std::vector<welfordAccumulator>> chunk_stats(NB_CHUNKS);
+    parallelFor(NB_CHUNKS, [&](int c)
         {
-            float sum = 0, sq_sum = 0;
-            for (auto p : data)
+            auto& stats = chunk_stats[c];
+            stats.resize((size_t)num_classes*num_vars);
+            int end = std::min(num_rows, (c + 1)*chunk_size);
+            for (int r = c*chunk_size; r < end; r++)
             {
-                if (p.second != y) continue;
-
-                sum += p.first[i];
-                sq_sum += p.first[i]*p.first[i];
+                welfordAccumulator* row_stats = stats.data() + (size_t)classes.find(outputs[r])->second*num_vars;
+                const float* x = rows.data() + (size_t)r*num_vars;
+                for (int i = 0; i < num_vars; i++) row_stats[i].add(x[i]);
             }
-            mean_xy.emplace(std::pair<int, float>(i, y), sum/count);
-            var_xy.emplace(std::pair<int, float>(i, y), sq_sum/count - (sum/count)*(sum/count));
+        });
+    std::vector<welfordAccumulator> stats = chunk_stats[0];
+    for (int c = 1; c < NB_CHUNKS; c++)
+    {
+        for (size_t k = 0; k < stats.size(); k++) stats[k].merge(chunk_stats[c][k]);
+        std::vector<welfordAccumulator>().swap(chunk_stats[c]);
+    }
+
+    // Compute P(y), and the distribution of each feature for each class.
+    for (int y = 0; y < num_classes; y++)
+    {
+        prob_y.emplace(ys[y], ((float)stats[(size_t)y*num_vars].count)/data.size());
+        for (int i = 0; i < num_vars; i++)
+        {
+            auto& a = stats[(size_t)y*num_vars + i];
+            mean_xy.emplace(std::pair<int, float>(i, ys[y]), a.mean);
+            var_xy.emplace(std::pair<int, float>(i, ys[y]), a.m2/a.count);
         }
     }
 
@@ -105,6 +158,8 @@ int main(int argc, char** argv)
         std::cout << "Options:" << std::endl;
         std::cout << " -o <path> | --output <path>: "
                   << " The file path to output learnt model." << std::endl;
+        std::cout << " -j <value> | --threads <value>: "
+                  << "Number of threads used to compute the statistics (does not change the model)." << std::endl;
         std::cout << " -h | --help: "
                   << "Usage and options for the model training." << std::endl;
         return 0;
@@ -120,6 +175,14 @@ int main(int argc, char** argv)
     {
         path_to_output_model = config_map["output"];
     }
+    if (config_map.find("j") != config_map.end())
+    {
+        num_threads = std::stoi(config_map["j"]);
+    }
+    if (config_map.find("threads") != config_map.end())
+    {
+        num_threads = std::stoi(config_map["threads"]);
+    }
     path_to_train_data = argv[argc - 1];
 
     std::cout << "Loading data ... " << std::endl;